@@ -0,0 +1,78 @@
+// Allocation benchmark: time creating, writing and removing
+// small files on an empty file system, then again after
+// filling it to about 85%. Run it on a fresh fs.img.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fs.h"
+#include "fcntl.h"
+#include "param.h"
+
+#define ROUNDS 200
+#define FILEBLOCKS 4
+#define WINDOW 10
+
+char buf[BSIZE];
+
+void
+setname(char *name, int i)
+{
+  name[2] = '0' + (i/10)%10;
+  name[3] = '0' + i%10;
+}
+
+// Create, write and remove ROUNDS small files, keeping the
+// last WINDOW of them around; return the ticks it took.
+int
+churn(void)
+{
+  int i, j, fd, t0;
+  char name[] = "ab00";
+
+  t0 = vuptime();
+  for(i = 0; i < ROUNDS + WINDOW; i++){
+    if(i >= WINDOW){
+      setname(name, i - WINDOW);
+      unlink(name);
+    }
+    if(i >= ROUNDS)
+      continue;
+    setname(name, i);
+    if((fd = open(name, O_CREATE|O_RDWR)) < 0){
+      printf(1, "allocbench: create failed\n");
+      exit();
+    }
+    for(j = 0; j < FILEBLOCKS; j++)
+      write(fd, buf, sizeof(buf));
+    close(fd);
+  }
+  return vuptime() - t0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int fd, i, t;
+
+  memset(buf, 'a', sizeof(buf));
+  t = churn();
+  printf(1, "allocbench: empty fs: %d files in %d ticks\n", ROUNDS, t);
+
+  if((fd = open("abfill", O_CREATE|O_RDWR)) < 0){
+    printf(1, "allocbench: cannot create abfill\n");
+    exit();
+  }
+  for(i = 0; i < FSSIZE*8/10; i++){
+    if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+      printf(1, "allocbench: fill failed\n");
+      exit();
+    }
+  }
+  close(fd);
+
+  t = churn();
+  printf(1, "allocbench: 85%% full fs: %d files in %d ticks\n", ROUNDS, t);
+  unlink("abfill");
+  exit();
+}
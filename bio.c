@@ -6,8 +6,10 @@
 // a synchronization point for disk blocks used by multiple processes.
 //
 // Interface:
-// * To get a buffer for a particular disk block, call bread.
-// * After changing buffer data, call bwrite to write it to disk.
+// * To get a buffer for a particular disk block, call bread,
+//     or breadn for several consecutive blocks.
+// * After changing buffer data, call bwrite to write it to disk,
+//     or bdwrite to write it back later.
 // * When done with the buffer, call brelse.
 // * Do not use the buffer after calling brelse.
 // * Only one process at a time can use a buffer,
@@ -17,6 +19,8 @@
 // * B_VALID: the buffer data has been read from the disk.
 // * B_DIRTY: the buffer data has been modified
 //     and needs to be written to disk.
+// * B_DELAY: the buffer holds file data that bflush or
+//     buffer recycling will write to disk later.
 
 #include "types.h"
 #include "defs.h"
@@ -26,6 +30,8 @@
 #include "fs.h"
 #include "buf.h"
 
+static void bundelay(struct buf*);
+
 struct {
   struct spinlock lock;
   struct buf buf[NBUF];
@@ -33,6 +39,7 @@ struct {
   // Linked list of all buffers, through prev/next.
   // head.next is most recently used.
   struct buf head;
+  int nwait;  // processes in bget waiting for a free buffer
 } bcache;
 
 void
@@ -56,13 +63,16 @@ binit(void)
 }
 
 // Look through buffer cache for block on device dev.
-// If not found, allocate a buffer.
-// In either case, return locked buffer.
+// If not found, allocate a buffer, waiting for one to be
+// released if all are in use; or, if wait is 0, return 0
+// rather than wait or write a delayed block back.
+// Otherwise return the locked buffer.
 static struct buf*
-bget(uint dev, uint blockno)
+bget(uint dev, uint blockno, int wait)
 {
   struct buf *b;
 
+loop:
   acquire(&bcache.lock);
 
   // Is the block already cached?
@@ -76,10 +86,11 @@ bget(uint dev, uint blockno)
   }
 
   // Not cached; recycle an unused buffer.
-  // Even if refcnt==0, B_DIRTY indicates a buffer is in use
-  // because log.c has modified it but not yet committed it.
+  // log.c pins the blocks of uncommitted and uninstalled
+  // transactions by holding a reference, so refcnt==0
+  // means the disk copy is up to date.
   for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0 && (b->flags & B_DIRTY) == 0) {
+    if(b->refcnt == 0 && (b->flags & (B_DIRTY|B_DELAY)) == 0) {
       b->dev = dev;
       b->blockno = blockno;
       b->flags = 0;
@@ -89,7 +100,31 @@ bget(uint dev, uint blockno)
       return b;
     }
   }
-  panic("bget: no buffers");
+
+  if(!wait){
+    release(&bcache.lock);
+    return 0;
+  }
+
+  // Every unused buffer holds a delayed write.
+  // Write back the least recently used one and retry.
+  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
+    if(b->refcnt == 0) {
+      b->refcnt++;
+      release(&bcache.lock);
+      acquiresleep(&b->lock);
+      bundelay(b);
+      brelse(b);
+      goto loop;
+    }
+  }
+
+  // Every buffer is in use; wait for a brelse.
+  bcache.nwait++;
+  sleep(&bcache, &bcache.lock);
+  bcache.nwait--;
+  release(&bcache.lock);
+  goto loop;
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -98,13 +133,44 @@ bread(uint dev, uint blockno)
 {
   struct buf *b;
 
-  b = bget(dev, blockno);
+  b = bget(dev, blockno, 1);
   if((b->flags & B_VALID) == 0) {
     iderw(b);
   }
   return b;
 }
 
+// Return locked bufs bs[0..m) for the first m of the n blocks
+// starting at blockno, and return m. Only the first buf is
+// waited for: a process must not sleep for a buffer while it
+// holds others, so the run stops short when the cache runs
+// out. Each run of blocks that are not cached is read with a
+// single disk request.
+int
+breadn(uint dev, uint blockno, int n, struct buf **bs)
+{
+  int i, j;
+
+  if(n > NRUN)
+    panic("breadn");
+  for(i = 0; i < n; i++)
+    if((bs[i] = bget(dev, blockno + i, i == 0)) == 0)
+      break;
+  n = i;
+  for(i = 0; i < n; i = j){
+    for(j = i + 1; j < n; j++){
+      if((bs[i]->flags & B_VALID) || (bs[j]->flags & B_VALID))
+        break;
+      bs[j-1]->rnext = bs[j];
+    }
+    if((bs[i]->flags & B_VALID) == 0)
+      iderw(bs[i]);
+    for(; i < j; i++)
+      bs[i]->rnext = 0;
+  }
+  return n;
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
@@ -115,6 +181,52 @@ bwrite(struct buf *b)
   iderw(b);
 }
 
+// Mark b's contents to be written to disk later instead of
+// now. inum names the inode the data belongs to, for bflush.
+// Must be locked.
+void
+bdwrite(struct buf *b, uint inum)
+{
+  if(!holdingsleep(&b->lock))
+    panic("bdwrite");
+  b->flags |= B_DELAY;
+  b->inum = inum;
+}
+
+// Write b to disk if it holds a delayed write. Must be locked.
+static void
+bundelay(struct buf *b)
+{
+  if(b->flags & B_DELAY){
+    b->flags &= ~B_DELAY;
+    b->flags |= B_DIRTY;
+    iderw(b);
+  }
+}
+
+// Write back the delayed writes of inode inum on dev,
+// or of every inode on dev if inum is 0.
+void
+bflush(uint dev, uint inum)
+{
+  struct buf *b;
+
+loop:
+  acquire(&bcache.lock);
+  for(b = bcache.head.next; b != &bcache.head; b = b->next){
+    if(b->dev == dev && (b->flags & B_DELAY) &&
+       (inum == 0 || b->inum == inum)){
+      b->refcnt++;
+      release(&bcache.lock);
+      acquiresleep(&b->lock);
+      bundelay(b);
+      brelse(b);
+      goto loop;
+    }
+  }
+  release(&bcache.lock);
+}
+
 // Release a locked buffer.
 // Move to the head of the MRU list.
 void
@@ -135,10 +247,45 @@ brelse(struct buf *b)
     b->prev = &bcache.head;
     bcache.head.next->prev = b;
     bcache.head.next = b;
+    if(bcache.nwait)
+      wakeup(&bcache);
   }
   
   release(&bcache.lock);
 }
+
+// Keep b in the cache even after its last brelse().
+void
+bpin(struct buf *b)
+{
+  acquire(&bcache.lock);
+  b->refcnt++;
+  b->pins++;
+  release(&bcache.lock);
+}
+
+void
+bunpin(struct buf *b)
+{
+  acquire(&bcache.lock);
+  b->refcnt--;
+  b->pins--;
+  if(b->refcnt == 0 && bcache.nwait)
+    wakeup(&bcache);
+  release(&bcache.lock);
+}
+
+// Does the log hold a copy of b that is not yet installed?
+int
+bpinned(struct buf *b)
+{
+  int r;
+
+  acquire(&bcache.lock);
+  r = b->pins > 0;
+  release(&bcache.lock);
+  return r;
+}
 //PAGEBREAK!
 // Blank page.
 
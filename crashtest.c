@@ -0,0 +1,109 @@
+// Crash consistency test for delayed writes and the log.
+// Run "crashtest w", wait for "kill qemu now", kill QEMU while
+// it keeps writing, then boot the same fs.img and run
+// "crashtest c". Everything written before an fsync() must
+// survive, and no file may contain blocks of garbage.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fs.h"
+#include "fcntl.h"
+
+#define NFILES  4
+#define NSYNCED 16   // blocks per file made durable with fsync
+
+char buf[BSIZE];
+char name[] = "crash0";
+
+// Block b of every file is filled with the byte 'A'+b%26.
+void
+fill(int b)
+{
+  memset(buf, 'A' + b%26, sizeof(buf));
+}
+
+void
+writer(void)
+{
+  int fd[NFILES], i, b;
+
+  for(i = 0; i < NFILES; i++){
+    name[5] = '0' + i;
+    if((fd[i] = open(name, O_CREATE|O_RDWR)) < 0){
+      printf(1, "crashtest: cannot create %s\n", name);
+      exit();
+    }
+  }
+  for(b = 0; b < NSYNCED; b++){
+    fill(b);
+    for(i = 0; i < NFILES; i++)
+      write(fd[i], buf, sizeof(buf));
+  }
+  for(i = 0; i < NFILES; i++)
+    fsync(fd[i]);
+  printf(1, "crashtest: %d blocks synced; kill qemu now\n", NSYNCED);
+
+  // Keep rewriting and appending, unsynced, until killed.
+  for(;;){
+    for(i = 0; i < NFILES; i++){
+      close(fd[i]);
+      name[5] = '0' + i;
+      fd[i] = open(name, O_RDWR);
+    }
+    for(b = 0; b < 2*NSYNCED; b++){
+      fill(b);
+      for(i = 0; i < NFILES; i++)
+        write(fd[i], buf, sizeof(buf));
+    }
+  }
+}
+
+// Each file must hold at least the synced blocks, and every
+// whole block must carry its pattern.
+void
+checker(void)
+{
+  struct stat st;
+  int fd, i, b, n, bad;
+
+  bad = 0;
+  for(i = 0; i < NFILES; i++){
+    name[5] = '0' + i;
+    if((fd = open(name, O_RDONLY)) < 0){
+      printf(1, "crashtest: %s missing\n", name);
+      bad++;
+      continue;
+    }
+    fstat(fd, &st);
+    if(st.size < NSYNCED*BSIZE){
+      printf(1, "crashtest: %s has %d bytes, want >= %d\n",
+             name, st.size, NSYNCED*BSIZE);
+      bad++;
+    }
+    for(b = 0; (n = read(fd, buf, sizeof(buf))) > 0; b++){
+      if(n != sizeof(buf))
+        break;
+      if(buf[0] != 'A' + b%26 || buf[BSIZE-1] != buf[0]){
+        printf(1, "crashtest: %s block %d corrupt\n", name, b);
+        bad++;
+        break;
+      }
+    }
+    close(fd);
+    unlink(name);
+  }
+  printf(1, "crashtest: %s\n", bad ? "FAILED" : "ok");
+}
+
+int
+main(int argc, char *argv[])
+{
+  if(argc == 2 && argv[1][0] == 'w')
+    writer();
+  else if(argc == 2 && argv[1][0] == 'c')
+    checker();
+  else
+    printf(2, "usage: crashtest w|c\n");
+  exit();
+}
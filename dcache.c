@@ -0,0 +1,223 @@
+// Directory entry cache.
+//
+// Remembers the result of looking up a name in a directory,
+// keyed by (device, directory inode number, name), so that path
+// lookups need neither lock the directory nor read its blocks.
+// An entry with inum 0 is negative: the name is known to be
+// absent.
+//
+// Entries must match the directories on disk. dirlookup fills
+// the cache; dirlink and unlink update it while they hold the
+// directory's lock; iput purges a directory's entries when it
+// frees the directory, since its inode number can be reused.
+// xv6 has no rename.
+//
+// dcache.lock serializes changes, which bracket themselves with
+// dcbegin and dcend so that dcache.seq is odd while they run.
+// dclookup takes no lock: it reads an entry and then checks
+// that dcache.seq has not moved, trying again if it has.
+// A lookup cannot move its entry to the front of the LRU list
+// without the lock, so it marks it used instead, and recycling
+// gives used entries a second chance.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "spinlock.h"
+#include "fs.h"
+
+struct dentry {
+  uint dev;
+  uint dir;              // inode number of the directory
+  char name[DIRSIZ];
+  uint inum;             // 0 for a negative entry
+  uint off;              // offset of the dirent in dir
+  int used;              // looked up since it was last recycled
+  struct dentry *hnext;  // hash chain
+  struct dentry *prev;   // LRU list
+  struct dentry *next;
+};
+
+struct {
+  struct spinlock lock;
+  volatile uint seq;     // odd while an entry is changing
+  struct dentry dentry[NDENTRY];
+  struct dentry *hash[NDHASH];
+
+  // Linked list of all entries, through prev/next.
+  // head.next is most recently used.
+  struct dentry head;
+} dcache;
+
+void
+dcinit(void)
+{
+  struct dentry *d;
+
+  initlock(&dcache.lock, "dcache");
+  dcache.head.prev = &dcache.head;
+  dcache.head.next = &dcache.head;
+  for(d = dcache.dentry; d < dcache.dentry+NDENTRY; d++){
+    d->dir = 0;  // unused
+    d->next = dcache.head.next;
+    d->prev = &dcache.head;
+    dcache.head.next->prev = d;
+    dcache.head.next = d;
+  }
+}
+
+static uint
+dhash(uint dev, uint dir, char *name)
+{
+  uint h;
+  int i;
+
+  h = dev*31 + dir;
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = h*31 + name[i];
+  return h % NDHASH;
+}
+
+// Find the entry for name in dir. Caller holds dcache.lock.
+static struct dentry*
+dfind(uint dev, uint dir, char *name)
+{
+  struct dentry *d;
+
+  for(d = dcache.hash[dhash(dev, dir, name)]; d; d = d->hnext)
+    if(d->dev == dev && d->dir == dir && strncmp(d->name, name, DIRSIZ) == 0)
+      return d;
+  return 0;
+}
+
+// Start and end a change to the hash chains or to an entry.
+// Caller holds dcache.lock.
+static void
+dcbegin(void)
+{
+  dcache.seq++;
+  __sync_synchronize();
+}
+
+static void
+dcend(void)
+{
+  __sync_synchronize();
+  dcache.seq++;
+}
+
+// Take d off its hash chain and mark it unused.
+// Caller holds dcache.lock, between dcbegin and dcend.
+static void
+dunhash(struct dentry *d)
+{
+  struct dentry **pp;
+
+  for(pp = &dcache.hash[dhash(d->dev, d->dir, d->name)]; *pp; pp = &(*pp)->hnext){
+    if(*pp == d){
+      *pp = d->hnext;
+      break;
+    }
+  }
+  d->dir = 0;
+}
+
+// Move d to the front of the LRU list. Caller holds dcache.lock.
+static void
+dtouch(struct dentry *d)
+{
+  d->next->prev = d->prev;
+  d->prev->next = d->next;
+  d->next = dcache.head.next;
+  d->prev = &dcache.head;
+  dcache.head.next->prev = d;
+  dcache.head.next = d;
+}
+
+// Look up name in directory dir. If the cache knows the answer,
+// return 1 and set *inum (0 if absent) and, for a present name,
+// *off. Otherwise return 0.
+int
+dclookup(uint dev, uint dir, char *name, uint *inum, uint *off)
+{
+  struct dentry *d;
+  uint seq, ino, o;
+  int n;
+
+  rcubegin();
+  do {
+    while((seq = dcache.seq) & 1)
+      ;
+    __sync_synchronize();
+    ino = o = 0;
+    // A change may link the chain into a loop for a moment.
+    n = 0;
+    for(d = dcache.hash[dhash(dev, dir, name)]; d && n < NDENTRY; d = d->hnext, n++){
+      if(d->dev == dev && d->dir == dir && strncmp(d->name, name, DIRSIZ) == 0){
+        ino = d->inum;
+        o = d->off;
+        break;
+      }
+    }
+    __sync_synchronize();
+  } while(dcache.seq != seq);
+  if(d)
+    d->used = 1;
+  rcuend();
+
+  if(d == 0)
+    return 0;
+  *inum = ino;
+  if(off)
+    *off = o;
+  return 1;
+}
+
+// Record that name in dir refers to inum, in the dirent at off,
+// or that it is absent if inum is 0.
+void
+dcenter(uint dev, uint dir, char *name, uint inum, uint off)
+{
+  struct dentry *d;
+  uint h;
+
+  acquire(&dcache.lock);
+  dcbegin();
+  if((d = dfind(dev, dir, name)) == 0){
+    // Recycle the least recently used entry that has not
+    // been looked up since it last came to the front.
+    while((d = dcache.head.prev)->used){
+      d->used = 0;
+      dtouch(d);
+    }
+    if(d->dir)
+      dunhash(d);
+    d->dev = dev;
+    d->dir = dir;
+    strncpy(d->name, name, DIRSIZ);
+    h = dhash(dev, dir, name);
+    d->hnext = dcache.hash[h];
+    dcache.hash[h] = d;
+  }
+  d->inum = inum;
+  d->off = off;
+  d->used = 0;
+  dtouch(d);
+  dcend();
+  release(&dcache.lock);
+}
+
+// Forget every entry of directory dir.
+void
+dcpurge(uint dev, uint dir)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  dcbegin();
+  for(d = dcache.dentry; d < dcache.dentry+NDENTRY; d++)
+    if(d->dir == dir && d->dev == dev)
+      dunhash(d);
+  dcend();
+  release(&dcache.lock);
+}
@@ -2,19 +2,29 @@ struct buf;
 struct context;
 struct file;
 struct inode;
+struct iovec;
 struct pipe;
 struct proc;
+struct rcuhead;
 struct rtcdate;
 struct spinlock;
 struct sleeplock;
+struct rwsleeplock;
 struct stat;
+struct dirstat;
 struct superblock;
 
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
+int             breadn(uint, uint, int, struct buf**);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
+void            bdwrite(struct buf*, uint);
+void            bflush(uint, uint);
+void            bpin(struct buf*);
+void            bunpin(struct buf*);
+int             bpinned(struct buf*);
 
 // console.c
 void            consoleinit(void);
@@ -22,35 +32,60 @@ void            cprintf(char*, ...);
 void            consoleintr(int(*)(void));
 void            panic(char*) __attribute__((noreturn));
 
+// dcache.c
+void            dcinit(void);
+int             dclookup(uint, uint, char*, uint*, uint*);
+void            dcenter(uint, uint, char*, uint, uint);
+void            dcpurge(uint, uint);
+
 // exec.c
 int             exec(char*, char**);
 
 // file.c
+int             fdalloc(struct file*);
+void            fdclear(struct proc*, int);
+int             fdcopy(struct proc*, struct proc*);
+void            fdcloseall(struct proc*);
 struct file*    filealloc(void);
 void            fileclose(struct file*);
 struct file*    filedup(struct file*);
 void            fileinit(void);
 int             fileread(struct file*, char*, int n);
 int             filestat(struct file*, struct stat*);
+int             filegetdents(struct file*, struct dirstat*, int);
 int             filewrite(struct file*, char*, int n);
+int             filepread(struct file*, char*, int n, uint off);
+int             filepwrite(struct file*, char*, int n, uint off);
+int             filereadv(struct file*, struct iovec*, int);
+int             filewritev(struct file*, struct iovec*, int);
+int             filelseek(struct file*, int, int);
+int             filesend(struct file*, struct file*, uint*, int);
+int             fileallocate(struct file*, uint, uint);
+int             filesync(struct file*);
+int             filefcntl(struct file*, int, int);
 
 // fs.c
 void            readsb(int dev, struct superblock *sb);
 int             dirlink(struct inode*, char*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
-struct inode*   ialloc(uint, short);
+struct inode*   ialloc(uint, short, uint);
 struct inode*   idup(struct inode*);
 void            iinit(int dev);
 void            ilock(struct inode*);
 void            iput(struct inode*);
+int             ireserve(struct inode*, uint, uint);
 void            iunlock(struct inode*);
 void            iunlockput(struct inode*);
+void            ilockshared(struct inode*);
+void            iunlockshared(struct inode*);
 void            iupdate(struct inode*);
 int             namecmp(const char*, const char*);
 struct inode*   namei(char*);
 struct inode*   nameiparent(char*, char*);
 int             readi(struct inode*, char*, uint, uint);
+int             readifn(struct inode*, uint, uint, int (*)(void*, char*, int), void*);
 void            stati(struct inode*, struct stat*);
+int             dirstats(struct inode*, uint*, struct dirstat*, int);
 int             writei(struct inode*, char*, uint, uint);
 
 // ide.c
@@ -66,6 +101,7 @@ void            ioapicinit(void);
 // kalloc.c
 char*           kalloc(void);
 void            kfree(char*);
+int             kfreecount(void);
 void            kinit1(void*, void*);
 void            kinit2(void*, void*);
 
@@ -86,6 +122,7 @@ void            initlog(int dev);
 void            log_write(struct buf*);
 void            begin_op();
 void            end_op();
+void            log_force(void);
 
 // mp.c
 extern int      ismp;
@@ -100,6 +137,10 @@ int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, char*, int);
 int             pipewrite(struct pipe*, char*, int);
+int             pipespace(struct pipe*);
+int             pipeput(struct pipe*, char*, int);
+int             pipesize(struct pipe*);
+int             pipesetsize(struct pipe*, int);
 
 //PAGEBREAK: 16
 // proc.c
@@ -108,6 +149,7 @@ void            exit(void);
 int             fork(void);
 int             growproc(int);
 int             kill(int);
+int             kproc(char*, void(*)(void));
 struct cpu*     mycpu(void);
 struct proc*    myproc();
 void            pinit(void);
@@ -131,11 +173,30 @@ int             freemem(void);
 // swtch.S
 void            swtch(struct context**, struct context*);
 
+// rcu.c
+void            rcuinit(void);
+void            rcubegin(void);
+void            rcuend(void);
+void            rcuquiesce(void);
+void            rcuwait(void);
+void            rcudefer(struct rcuhead*, void (*)(struct rcuhead*));
+void            rcupoll(void);
+
+// ring.c
+void            ringinit(void);
+int             ringsetup(void);
+int             ringenter(int, int);
+int             ringwait(struct proc*);
+void            ringfree(struct proc*);
+
 // spinlock.c
 void            acquire(struct spinlock*);
 void            getcallerpcs(void*, uint*);
 int             holding(struct spinlock*);
 void            initlock(struct spinlock*, char*);
+void            initlockcls(struct spinlock*, char*, int);
+int             lockclass(char*);
+void            lockdump(void);
 void            release(struct spinlock*);
 void            pushcli(void);
 void            popcli(void);
@@ -145,6 +206,13 @@ void            acquiresleep(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
 int             holdingsleep(struct sleeplock*);
 void            initsleeplock(struct sleeplock*, char*);
+void            initrwsleeplock(struct rwsleeplock*, char*);
+void            acquireread(struct rwsleeplock*);
+void            releaseread(struct rwsleeplock*);
+void            acquirewrite(struct rwsleeplock*);
+void            releasewrite(struct rwsleeplock*);
+void            downgradewrite(struct rwsleeplock*);
+int             holdingwrite(struct rwsleeplock*);
 
 // string.c
 int             memcmp(const void*, const void*, uint);
@@ -163,6 +231,9 @@ int             fetchint(uint, int*);
 int             fetchstr(uint, char**);
 void            syscall(void);
 
+// sysfile.c
+struct file*    fileopen(char*, int);
+
 // timer.c
 void            timerinit(void);
 
@@ -177,6 +248,10 @@ void            uartinit(void);
 void            uartintr(void);
 void            uartputc(int);
 
+// vdso.c
+void            vdsoinit(void);
+void            vdsotick(uint);
+
 // vm.c
 void            seginit(void);
 void            kvmalloc(void);
@@ -190,6 +265,8 @@ int             loaduvm(pde_t*, char*, struct inode*, uint, uint);
 pde_t*          copyuvm(pde_t*, uint);
 void            switchuvm(struct proc*);
 void            switchkvm(void);
+int             vdsomap(pde_t*, struct proc*);
+int             ringmap(pde_t*, char*);
 int             copyout(pde_t*, uint, void*, uint);
 void            clearpteu(pde_t *pgdir, char *uva);
 
@@ -0,0 +1,70 @@
+// Directory benchmark: time creating, looking up and removing
+// NFILES empty files in one directory. Run it on a fresh fs.img.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+
+#define NFILES 10000
+
+char name[] = "db/f00000";
+
+void
+setname(int i)
+{
+  int k;
+
+  for(k = 8; k >= 4; k--){
+    name[k] = '0' + i%10;
+    i /= 10;
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i, fd, t0, n;
+
+  n = NFILES;
+  if(argc > 1)
+    n = atoi(argv[1]);
+  if(mkdir("db") < 0){
+    printf(1, "dirbench: mkdir db failed\n");
+    exit();
+  }
+
+  t0 = vuptime();
+  for(i = 0; i < n; i++){
+    setname(i);
+    if((fd = open(name, O_CREATE|O_RDWR)) < 0){
+      printf(1, "dirbench: create %s failed\n", name);
+      exit();
+    }
+    close(fd);
+  }
+  printf(1, "dirbench: create %d files: %d ticks\n", n, vuptime() - t0);
+
+  t0 = vuptime();
+  for(i = 0; i < n; i++){
+    setname((i * 7919) % n);
+    if((fd = open(name, O_RDONLY)) < 0){
+      printf(1, "dirbench: lookup %s failed\n", name);
+      exit();
+    }
+    close(fd);
+  }
+  printf(1, "dirbench: look up %d files: %d ticks\n", n, vuptime() - t0);
+
+  t0 = vuptime();
+  for(i = 0; i < n; i++){
+    setname(i);
+    if(unlink(name) < 0){
+      printf(1, "dirbench: unlink %s failed\n", name);
+      exit();
+    }
+  }
+  printf(1, "dirbench: unlink %d files: %d ticks\n", n, vuptime() - t0);
+  unlink("db");
+  exit();
+}
@@ -2,3 +2,21 @@
 #define O_WRONLY  0x001
 #define O_RDWR    0x002
 #define O_CREATE  0x200
+#define O_EXTENT  0x400
+
+// lseek whence
+#define SEEK_SET  0
+#define SEEK_CUR  1
+#define SEEK_END  2
+
+// fcntl commands
+#define F_GETPIPE_SZ 1  // size of a pipe's buffer
+#define F_SETPIPE_SZ 2  // resize it to hold at least arg bytes
+
+// readv, writev
+#define IOV_MAX   16  // max segments per call
+
+struct iovec {
+  void *base;
+  int len;
+};
@@ -5,10 +5,17 @@
 #include "types.h"
 #include "defs.h"
 #include "param.h"
+#include "mmu.h"
 #include "fs.h"
+#include "stat.h"
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "file.h"
+#include "fcntl.h"
+#include "proc.h"
+
+// Bytes one transaction may write to a file; see fileiwrite.
+#define FILEWMAX (((MAXOPBLOCKS-1-1-3-2) / 2) * BSIZE)
 
 struct devsw devsw[NDEV];
 struct {
@@ -79,79 +86,487 @@ fileclose(struct file *f)
   }
 }
 
+// Lock f's inode to read it at *off, and return whether the
+// lock is shared. Readers can share the inode lock, but f->off
+// belongs to every process holding f, so readers at f->off must
+// take turns unless f is ours alone: then no one else can get at
+// f until this system call returns. Devices get the lock to
+// themselves too, since their read functions drop and retake it.
+static int
+ilockread(struct file *f, uint *off)
+{
+  if(off != &f->off || f->ref == 1){
+    ilockshared(f->ip);
+    if(f->ip->type != T_DEV)
+      return 1;
+    iunlockshared(f->ip);
+  }
+  ilock(f->ip);
+  return 0;
+}
+
+static void
+iunlockread(struct file *f, int shared)
+{
+  if(shared)
+    iunlockshared(f->ip);
+  else
+    iunlock(f->ip);
+}
+
+// Read up to n entries of directory f, with their metadata.
+int
+filegetdents(struct file *f, struct dirstat *ds, int n)
+{
+  int r, shared;
+
+  if(f->readable == 0 || f->type != FD_INODE)
+    return -1;
+  shared = ilockread(f, &f->off);
+  r = dirstats(f->ip, &f->off, ds, n);
+  iunlockread(f, shared);
+  return r;
+}
+
 // Get metadata about file f.
 int
 filestat(struct file *f, struct stat *st)
 {
   if(f->type == FD_INODE){
-    ilock(f->ip);
+    ilockshared(f->ip);
     stati(f->ip, st);
-    iunlock(f->ip);
+    iunlockshared(f->ip);
     return 0;
   }
   return -1;
 }
 
+// Read from file f at *off, advancing *off.
+static int
+fileiread(struct file *f, char *addr, int n, uint *off)
+{
+  int r, shared;
+
+  if(off == &f->off)
+    shared = ilockread(f, &f->off);
+  else {
+    ilockshared(f->ip);
+    shared = 1;
+  }
+  if((r = readi(f->ip, addr, *off, n)) > 0)
+    *off += r;
+  iunlockread(f, shared);
+  return r;
+}
+
 // Read from file f.
 int
 fileread(struct file *f, char *addr, int n)
 {
-  int r;
-
   if(f->readable == 0)
     return -1;
   if(f->type == FD_PIPE)
     return piperead(f->pipe, addr, n);
-  if(f->type == FD_INODE){
+  if(f->type == FD_INODE)
+    return fileiread(f, addr, n, &f->off);
+  panic("fileread");
+}
+
+// Read from file f at offset off, leaving f->off alone.
+int
+filepread(struct file *f, char *addr, int n, uint off)
+{
+  if(f->readable == 0 || f->type != FD_INODE)
+    return -1;
+  return fileiread(f, addr, n, &off);
+}
+
+// Read from file f into the cnt buffers of iov, in order.
+// An inode is locked once for the whole call.
+int
+filereadv(struct file *f, struct iovec *iov, int cnt)
+{
+  int i, n, r, shared;
+
+  if(f->readable == 0)
+    return -1;
+  if(f->type == FD_PIPE)
+    return piperead(f->pipe, iov[0].base, iov[0].len);
+  if(f->type != FD_INODE)
+    panic("filereadv");
+  n = 0;
+  shared = ilockread(f, &f->off);
+  for(i = 0; i < cnt; i++){
+    if((r = readi(f->ip, iov[i].base, f->off, iov[i].len)) < 0){
+      n = -1;
+      break;
+    }
+    f->off += r;
+    n += r;
+    if(r < iov[i].len)
+      break;
+  }
+  iunlockread(f, shared);
+  return n;
+}
+
+//PAGEBREAK!
+// Write to file f at *off, advancing *off.
+static int
+fileiwrite(struct file *f, char *addr, int n, uint *off)
+{
+  int r;
+
+  // write a few blocks at a time to avoid exceeding
+  // the maximum log transaction size, including
+  // i-node, super block, up to three levels of
+  // indirect blocks, allocation blocks, and 2 blocks
+  // of slop for non-aligned writes.
+  // this really belongs lower down, since writei()
+  // might be writing a device like the console.
+  int max = FILEWMAX;
+  int i = 0;
+  while(i < n){
+    int n1 = n - i;
+    if(n1 > max)
+      n1 = max;
+
+    begin_op();
     ilock(f->ip);
-    if((r = readi(f->ip, addr, f->off, n)) > 0)
-      f->off += r;
+    if ((r = writei(f->ip, addr + i, *off, n1)) > 0)
+      *off += r;
     iunlock(f->ip);
-    return r;
+    end_op();
+
+    if(r < 0)
+      break;
+    if(r != n1)
+      panic("short filewrite");
+    i += r;
   }
-  panic("fileread");
+  return i == n ? n : -1;
 }
 
-//PAGEBREAK!
 // Write to file f.
 int
 filewrite(struct file *f, char *addr, int n)
 {
-  int r;
-
   if(f->writable == 0)
     return -1;
   if(f->type == FD_PIPE)
     return pipewrite(f->pipe, addr, n);
-  if(f->type == FD_INODE){
-    // write a few blocks at a time to avoid exceeding
-    // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
-    // and 2 blocks of slop for non-aligned writes.
-    // this really belongs lower down, since writei()
-    // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * 512;
-    int i = 0;
-    while(i < n){
-      int n1 = n - i;
-      if(n1 > max)
-        n1 = max;
-
-      begin_op();
-      ilock(f->ip);
-      if ((r = writei(f->ip, addr + i, f->off, n1)) > 0)
-        f->off += r;
-      iunlock(f->ip);
-      end_op();
-
-      if(r < 0)
+  if(f->type == FD_INODE)
+    return fileiwrite(f, addr, n, &f->off);
+  panic("filewrite");
+}
+
+// Write to file f at offset off, leaving f->off alone.
+int
+filepwrite(struct file *f, char *addr, int n, uint off)
+{
+  if(f->writable == 0 || f->type != FD_INODE)
+    return -1;
+  return fileiwrite(f, addr, n, &off);
+}
+
+// Write the cnt buffers of iov to file f, in order.
+// If they fit in one transaction, they are written in one
+// and so reach the disk together. Returns the bytes written,
+// or -1 if an error stopped it before any were.
+int
+filewritev(struct file *f, struct iovec *iov, int cnt)
+{
+  int i, r;
+  uint n, tot;
+
+  if(f->writable == 0)
+    return -1;
+  n = 0;
+  for(i = 0; i < cnt; i++){
+    if(iov[i].len < 0 || n + iov[i].len > 0x7fffffff)
+      return -1;
+    n += iov[i].len;
+  }
+  tot = 0;
+  if(f->type == FD_INODE && n <= FILEWMAX){
+    begin_op();
+    ilock(f->ip);
+    for(i = 0; i < cnt; i++){
+      if((r = writei(f->ip, iov[i].base, f->off, iov[i].len)) < 0)
+        break;
+      f->off += r;
+      tot += r;
+      if(r != iov[i].len)
         break;
-      if(r != n1)
-        panic("short filewrite");
-      i += r;
     }
-    return i == n ? n : -1;
+    iunlock(f->ip);
+    end_op();
+  } else {
+    for(i = 0; i < cnt; i++){
+      if(filewrite(f, iov[i].base, iov[i].len) != iov[i].len)
+        break;
+      tot += iov[i].len;
+    }
   }
-  panic("filewrite");
+  if(i < cnt && tot == 0)
+    return -1;
+  return tot;
 }
 
+// Set the offset of file f as lseek(2) does.
+int
+filelseek(struct file *f, int off, int whence)
+{
+  int base;
+
+  if(f->type != FD_INODE)
+    return -1;
+  switch(whence){
+  case SEEK_SET:
+    base = 0;
+    break;
+  case SEEK_CUR:
+    base = f->off;
+    break;
+  case SEEK_END:
+    ilockshared(f->ip);
+    base = f->ip->size;
+    iunlockshared(f->ip);
+    break;
+  default:
+    return -1;
+  }
+  if(base + off < 0)
+    return -1;
+  f->off = base + off;
+  return f->off;
+}
+
+// Carry out fcntl(2) command cmd on file f.
+int
+filefcntl(struct file *f, int cmd, int arg)
+{
+  switch(cmd){
+  case F_GETPIPE_SZ:
+    if(f->type != FD_PIPE)
+      return -1;
+    return pipesize(f->pipe);
+  case F_SETPIPE_SZ:
+    if(f->type != FD_PIPE)
+      return -1;
+    return pipesetsize(f->pipe, arg);
+  }
+  return -1;
+}
+
+static int
+topipe(void *p, char *src, int n)
+{
+  return pipeput((struct pipe*)p, src, n);
+}
+
+// Copy n bytes of file in, starting at *off, to file out
+// and advance *off. Into a pipe the data goes straight from
+// the buffer cache; into a file it goes through one kernel
+// page, since holding in's blocks while writing out's could
+// deadlock. Returns the number of bytes copied.
+int
+filesend(struct file *out, struct file *in, uint *off, int n)
+{
+  int r, m, tot;
+  char *page;
+
+  if(in->readable == 0 || in->type != FD_INODE || out->writable == 0)
+    return -1;
+  if(n < 0)
+    return -1;
+  ilockshared(in->ip);
+  r = in->ip->type;
+  iunlockshared(in->ip);
+  if(r == T_DEV)
+    return -1;
+
+  tot = 0;
+  if(out->type == FD_PIPE){
+    while(tot < n){
+      if((m = pipespace(out->pipe)) < 0)
+        return tot > 0 ? tot : -1;
+      if(m > n - tot)
+        m = n - tot;
+      ilockshared(in->ip);
+      r = readifn(in->ip, *off, m, topipe, out->pipe);
+      iunlockshared(in->ip);
+      if(r <= 0)
+        break;
+      *off += r;
+      tot += r;
+    }
+    return tot;
+  }
+
+  if(out->type != FD_INODE || (page = kalloc()) == 0)
+    return -1;
+  while(tot < n){
+    m = n - tot;
+    if(m > PGSIZE)
+      m = PGSIZE;
+    ilockshared(in->ip);
+    r = readi(in->ip, page, *off, m);
+    iunlockshared(in->ip);
+    if(r <= 0)
+      break;
+    if(filewrite(out, page, r) != r){
+      kfree(page);
+      return tot > 0 ? tot : -1;
+    }
+    *off += r;
+    tot += r;
+  }
+  kfree(page);
+  return tot;
+}
+
+// Make f's data and metadata durable.
+int
+filesync(struct file *f)
+{
+  if(f->type == FD_INODE)
+    bflush(f->ip->dev, f->ip->inum);
+  log_force();
+  return 0;
+}
+
+// Allocate the blocks for bytes off..off+len of file f ahead
+// of time, without changing its size. Since files have no holes,
+// any missing blocks before off are allocated too.
+int
+fileallocate(struct file *f, uint off, uint len)
+{
+  uint bn, end, n;
+  int r;
+
+  if(f->writable == 0 || f->type != FD_INODE)
+    return -1;
+  if(off + len < off)
+    return -1;
+  // Files have no holes, so start no later than the end.
+  end = (off + len + BSIZE-1) / BSIZE;
+  ilock(f->ip);
+  if(off > f->ip->size)
+    off = f->ip->size;
+  iunlock(f->ip);
+
+  // a few blocks per transaction, as in filewrite.
+  int max = (MAXOPBLOCKS-1-1-3) / 2;
+  bn = off / BSIZE;
+  for(; bn < end; bn += n){
+    n = end - bn;
+    if(n > max)
+      n = max;
+    begin_op();
+    ilock(f->ip);
+    r = ireserve(f->ip, bn, n);
+    iunlock(f->ip);
+    end_op();
+    if(r < 0)
+      return -1;
+  }
+  return 0;
+}
+
+// Per-process descriptor tables. A process starts with the
+// NOFILE slots in struct proc, and moves to a page of NOFILEMAX
+// slots, behind their bitmap, when it opens more. fdmap has a
+// bit set for each open descriptor, so finding the lowest free
+// one looks at a word at a time.
+
+// Move p's descriptors to a page of NOFILEMAX.
+static int
+fdgrow(struct proc *p)
+{
+  char *mem;
+
+  if(p->nofile >= NOFILEMAX || (mem = kalloc()) == 0)
+    return -1;
+  memset(mem, 0, PGSIZE);
+  memmove(mem, p->fdmap, (p->nofile+31)/32 * sizeof(uint));
+  memmove(mem + NOFILEMAX/8, p->ofile, p->nofile * sizeof(struct file*));
+  p->fdmap = (uint*)mem;
+  p->ofile = (struct file**)(mem + NOFILEMAX/8);
+  p->nofile = NOFILEMAX;
+  return 0;
+}
+
+// Allocate the lowest free file descriptor for the given file.
+// Takes over file reference from caller on success.
+int
+fdalloc(struct file *f)
+{
+  struct proc *p = myproc();
+  int i, fd;
+
+  for(;;){
+    for(i = 0; i*32 < p->nofile; i++){
+      if(p->fdmap[i] == ~0U)
+        continue;
+      fd = i*32 + __builtin_ctz(~p->fdmap[i]);
+      if(fd >= p->nofile)
+        break;
+      p->fdmap[i] |= 1U << (fd%32);
+      p->ofile[fd] = f;
+      return fd;
+    }
+    if(fdgrow(p) < 0)
+      return -1;
+  }
+}
+
+// Forget descriptor fd of p. The caller closes the file.
+void
+fdclear(struct proc *p, int fd)
+{
+  p->ofile[fd] = 0;
+  p->fdmap[fd/32] &= ~(1U << (fd%32));
+}
+
+// Give new process np a copy of p's descriptors.
+int
+fdcopy(struct proc *np, struct proc *p)
+{
+  int i, fd;
+  uint m;
+
+  if(np->nofile < p->nofile && fdgrow(np) < 0)
+    return -1;
+  for(i = 0; i*32 < p->nofile; i++){
+    np->fdmap[i] = m = p->fdmap[i];
+    for(; m; m &= m-1){
+      fd = i*32 + __builtin_ctz(m);
+      np->ofile[fd] = filedup(p->ofile[fd]);
+    }
+  }
+  return 0;
+}
+
+// Close all of p's descriptors, as it exits.
+void
+fdcloseall(struct proc *p)
+{
+  int i, fd;
+  uint m;
+
+  for(i = 0; i*32 < p->nofile; i++){
+    for(m = p->fdmap[i]; m; m &= m-1){
+      fd = i*32 + __builtin_ctz(m);
+      fileclose(p->ofile[fd]);
+      p->ofile[fd] = 0;
+    }
+    p->fdmap[i] = 0;
+  }
+  if(p->ofile != p->ofile0){
+    kfree((char*)p->fdmap);
+    p->ofile = p->ofile0;
+    p->fdmap = &p->fdmap0;
+    p->nofile = NOFILE;
+  }
+}
@@ -13,16 +13,24 @@ struct file {
 struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
-  int ref;            // Reference count
-  struct sleeplock lock; // protects everything below here
+  int ref;            // Reference count; atomic, see fs.c
+  struct rwsleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
+  uint goal;          // where to allocate the next block, or 0
+  uint rnext, rend;   // reservation window; windows.lock protects
+  int rgroup;         // group whose window list holds ip
+  struct inode *rlink;  // window list
+  struct inode *hnext;  // hash chain; bucket lock protects
+  struct inode *prev;   // LRU list of idle inodes; icache.lock protects
+  struct inode *next;
+  struct inode *inext;  // list of all inodes
 
   short type;         // copy of disk inode
   short major;
   short minor;
   short nlink;
   uint size;
-  uint addrs[NDIRECT+1];
+  uint addrs[NADDRS];
 };
 
 // table mapping major device number to
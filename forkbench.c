@@ -0,0 +1,62 @@
+// Process table benchmark: with many idle processes around,
+// time fork/exit/wait cycles and setnice() lookups by pid.
+// Neither should slow down as the number of processes grows.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+#define ROUNDS 500
+#define LOOKUPS 20000
+
+void
+run(int nidle)
+{
+  int i, pid, t0, t1, p[2];
+  char c;
+  int pids[64];
+
+  // Idle processes that sleep until their pipe closes.
+  pipe(p);
+  for(i = 0; i < nidle; i++){
+    if((pids[i] = fork()) < 0){
+      printf(1, "forkbench: fork failed after %d\n", i);
+      nidle = i;
+      break;
+    }
+    if(pids[i] == 0){
+      close(p[1]);
+      read(p[0], &c, 1);
+      exit();
+    }
+  }
+  close(p[0]);
+
+  t0 = vuptime();
+  for(i = 0; i < ROUNDS; i++){
+    if((pid = fork()) == 0)
+      exit();
+    if(pid < 0 || wait() != pid){
+      printf(1, "forkbench: fork/wait failed\n");
+      break;
+    }
+  }
+  t1 = vuptime();
+  for(i = 0; i < LOOKUPS; i++)
+    setnice(nidle ? pids[i % nidle] : getpid(), 20);
+  printf(1, "forkbench: %d idle: %d fork/exit/wait %d ticks, %d setnice %d ticks\n",
+         nidle, ROUNDS, t1 - t0, LOOKUPS, vuptime() - t1);
+
+  close(p[1]);
+  for(i = 0; i < nidle; i++)
+    wait();
+}
+
+int
+main(int argc, char *argv[])
+{
+  run(0);
+  run(16);
+  run(48);
+  exit();
+}
@@ -23,6 +23,8 @@
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 static void itrunc(struct inode*);
+static int reserved(uint, struct inode*);
+static void windrop(struct inode*);
 // there should be one superblock per disk device, but we run with
 // only one device
 struct superblock sb; 
@@ -51,32 +53,134 @@ bzero(int dev, int bno)
 }
 
 // Blocks.
+//
+// The bitmap is searched one allocation group at a time, and
+// sb.gfree lets balloc skip full groups without reading their
+// bitmap. Each group has a cursor where its last search ended.
+// gfree[g] only changes while the bitmap block holding group g
+// is locked, and reaches the disk in the same transaction as
+// the bitmap.
+//
+// A file that grows also holds a reservation window of the
+// blocks after its last one (see iballoc). Windows only live in
+// memory; balloc keeps other files out of them while it can.
+// Each window is on the list of the group it starts in. RESWIN
+// is less than BPG, so block b can only be in windows on the
+// lists of b's group and the one before.
+
+static uint bcursor[MAXGROUPS];  // next block to try in each group
+
+static struct {
+  struct spinlock lock;
+  struct inode *group[MAXGROUPS];
+} windows;
+
+// Log the in-memory super block after a change to sb.gfree.
+static void
+sbwrite(uint dev)
+{
+  struct buf *bp;
 
-// Allocate a zeroed disk block.
+  bp = bread(dev, 1);
+  memmove(bp->data, &sb, sizeof(sb));
+  log_write(bp);
+  brelse(bp);
+}
+
+// Mark block b in use if it is free and not in the window of
+// an inode other than ip. bp is b's bitmap block.
+static int
+bclaim(struct buf *bp, uint b, struct inode *ip)
+{
+  int bi, m;
+
+  bi = b % BPB;
+  m = 1 << (bi % 8);
+  if(bp->data[bi/8] & m)
+    return 0;
+  if(ip && reserved(b, ip))
+    return 0;
+  bp->data[bi/8] |= m;  // Mark block in use.
+  log_write(bp);
+  sb.gfree[b / BPG]--;
+  return 1;
+}
+
+// Claim the first free block in from..to-1, which lie in one
+// group, for ip. Return it, or 0 if there is none.
 static uint
-balloc(uint dev)
+bscan(uint dev, uint from, uint to, struct inode *ip)
 {
-  int b, bi, m;
   struct buf *bp;
+  uint b;
 
-  bp = 0;
-  for(b = 0; b < sb.size; b += BPB){
-    bp = bread(dev, BBLOCK(b, sb));
-    for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
-      m = 1 << (bi % 8);
-      if((bp->data[bi/8] & m) == 0){  // Is block free?
-        bp->data[bi/8] |= m;  // Mark block in use.
-        log_write(bp);
-        brelse(bp);
-        bzero(dev, b + bi);
-        return b + bi;
-      }
+  bp = bread(dev, BBLOCK(from, sb));
+  for(b = from; b < to; b++){
+    if(b%8 == 0 && b+8 <= to && bp->data[(b%BPB)/8] == 0xff){
+      b += 7;  // skip a byte of used blocks
+      continue;
+    }
+    if(bclaim(bp, b, ip)){
+      brelse(bp);
+      return b;
+    }
+  }
+  brelse(bp);
+  return 0;
+}
+
+// Allocate a zeroed disk block for ip, at goal or as soon after
+// it as possible, trying goal's group first. Blocks in other
+// inodes' windows are taken only when nothing else is left.
+static uint
+balloc(uint dev, uint goal, struct inode *ip)
+{
+  uint i, g, b, start, end, from;
+
+  if(goal >= sb.size)
+    goal = 0;
+  for(i = 0; i < 2*sb.ngroups; i++){
+    if(i == sb.ngroups)
+      ip = 0;
+    g = (goal/BPG + i) % sb.ngroups;
+    if(sb.gfree[g] == 0)
+      continue;
+    start = g * BPG;
+    end = min(start + BPG, sb.size);
+    from = i == 0 ? goal : bcursor[g];
+    if(from < start || from >= end)
+      from = start;
+    if((b = bscan(dev, from, end, ip)) == 0 && from > start)
+      b = bscan(dev, start, from, ip);
+    if(b){
+      bcursor[g] = b + 1;
+      sbwrite(dev);
+      bzero(dev, b);
+      return b;
     }
-    brelse(bp);
   }
   panic("balloc: out of blocks");
 }
 
+// Allocate disk block b for ip if it is free; return 0 if not.
+static uint
+balloc_at(uint dev, uint b, struct inode *ip)
+{
+  struct buf *bp;
+  int ok;
+
+  if(b >= sb.size)
+    return 0;
+  bp = bread(dev, BBLOCK(b, sb));
+  ok = bclaim(bp, b, ip);
+  brelse(bp);
+  if(!ok)
+    return 0;
+  sbwrite(dev);
+  bzero(dev, b);
+  return b;
+}
+
 // Free a disk block.
 static void
 bfree(int dev, uint b)
@@ -91,7 +195,9 @@ bfree(int dev, uint b)
     panic("freeing free block");
   bp->data[bi/8] &= ~m;
   log_write(bp);
+  sb.gfree[b / BPG]++;
   brelse(bp);
+  sbwrite(dev);
 }
 
 // Inodes.
@@ -154,31 +260,67 @@ bfree(int dev, uint b)
 // have locked the inodes involved; this lets callers create
 // multi-step atomic operations.
 //
-// The icache.lock spin-lock protects the allocation of icache
-// entries. Since ip->ref indicates whether an entry is free,
-// and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold icache.lock while using any of those fields.
+// The cache is a hash table keyed by (dev, inum). Each bucket
+// has a spin-lock that protects its chain and the dev and inum
+// fields of the inodes on it, and that one must hold to take
+// ref to or from 0; other changes to ref are atomic. Idle
+// entries (ref 0) stay hashed, so a later iget can find them,
+// and sit on an LRU list from which iget recycles them.
+// An iget that finds an inode in use takes no lock at all: see
+// igetfast. Inodes are never freed, only reused, which is what
+// makes that safe. The cache grows a page of inodes at a time
+// while it is smaller than icache.max, or whenever every entry
+// is in use; icache.max is sized from free memory at boot.
+//
+// The icache.lock spin-lock protects the LRU list, the list of
+// all inodes, the reservation windows and the group cursors.
+// Acquire a bucket lock before icache.lock, never after.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
+// It is a reader-writer lock: ilockshared lets several processes
+// read an inode and its content at once, and ilock excludes
+// everyone else for changes.
+
+#define IPP (PGSIZE / sizeof(struct inode))  // inodes per page
+#define IHASH(dev, inum) (((dev)*31 + (inum)) % NIHASH)
+
+struct ibucket {
+  struct spinlock lock;
+  struct inode *head;
+};
 
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct ibucket bucket[NIHASH];
+  struct inode *all;       // every inode, through inext
+  int n, max;              // inodes allocated, and allowed while idle ones remain
+
+  // Linked list of idle inodes, through prev/next.
+  // lru.next is most recently used.
+  struct inode lru;
+  uint cursor[MAXGROUPS];  // lowest inode of each group that may be free
 } icache;
 
 void
 iinit(int dev)
 {
-  int i = 0;
-  
+  int i;
+
   initlock(&icache.lock, "icache");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&icache.inode[i].lock, "inode");
-  }
+  initlock(&windows.lock, "windows");
+  for(i = 0; i < NIHASH; i++)
+    initlock(&icache.bucket[i].lock, "ibucket");
+  icache.lru.prev = &icache.lru;
+  icache.lru.next = &icache.lru;
+  icache.max = kfreecount() / 256 * IPP;
+  if(icache.max < NINODE)
+    icache.max = NINODE;
 
   readsb(dev, &sb);
+  if(sb.ngroups == 0 || sb.ngroups > MAXGROUPS)
+    panic("iinit: bad super block");
   cprintf("sb: size %d nblocks %d ninodes %d nlog %d logstart %d\
  inodestart %d bmap start %d\n", sb.size, sb.nblocks,
           sb.ninodes, sb.nlog, sb.logstart, sb.inodestart,
@@ -190,25 +332,52 @@ static struct inode* iget(uint dev, uint inum);
 //PAGEBREAK!
 // Allocate an inode on device dev.
 // Mark it as allocated by  giving it type type.
+// A directory goes in the group with the most free blocks,
+// anything else in the group of its parent directory, so that
+// bmap can keep its data near both.
 // Returns an unlocked but allocated and referenced inode.
 struct inode*
-ialloc(uint dev, short type)
+ialloc(uint dev, short type, uint parent)
 {
-  int inum;
+  uint inum, i, g, g0, cur, end;
   struct buf *bp;
   struct dinode *dip;
 
-  for(inum = 1; inum < sb.ninodes; inum++){
-    bp = bread(dev, IBLOCK(inum, sb));
-    dip = (struct dinode*)bp->data + inum%IPB;
-    if(dip->type == 0){  // a free inode
-      memset(dip, 0, sizeof(*dip));
-      dip->type = type;
-      log_write(bp);   // mark it allocated on the disk
+  g0 = IGROUP(parent, sb);
+  if(type == T_DIR){
+    for(g = 0; g < sb.ngroups; g++)
+      if(sb.gfree[g] > sb.gfree[g0])
+        g0 = g;
+  }
+
+  for(i = 0; i < sb.ngroups; i++){
+    g = (g0 + i) % sb.ngroups;
+    acquire(&icache.lock);
+    cur = icache.cursor[g];
+    release(&icache.lock);
+    inum = cur > g*IPG(sb) ? cur : g*IPG(sb);
+    if(inum == 0)
+      inum = 1;
+    end = min((g+1)*IPG(sb), sb.ninodes);
+    for(; inum < end; inum++){
+      bp = bread(dev, IBLOCK(inum, sb));
+      dip = (struct dinode*)bp->data + inum%IPB;
+      if(dip->type == 0){  // a free inode
+        memset(dip, 0, sizeof(*dip));
+        dip->type = type;
+        log_write(bp);   // mark it allocated on the disk
+        brelse(bp);
+        break;
+      }
       brelse(bp);
-      return iget(dev, inum);
     }
-    brelse(bp);
+    // Advance the cursor, unless iput lowered it meanwhile.
+    acquire(&icache.lock);
+    if(icache.cursor[g] == cur)
+      icache.cursor[g] = inum < end ? inum + 1 : end;
+    release(&icache.lock);
+    if(inum < end)
+      return iget(dev, inum);
   }
   panic("ialloc: no inodes");
 }
@@ -235,38 +404,188 @@ iupdate(struct inode *ip)
   brelse(bp);
 }
 
+// Put idle inode ip at the head of the LRU list.
+// Caller holds icache.lock.
+static void
+lruput(struct inode *ip)
+{
+  ip->next = icache.lru.next;
+  ip->prev = &icache.lru;
+  icache.lru.next->prev = ip;
+  icache.lru.next = ip;
+}
+
+// Take ip off the LRU list. Caller holds icache.lock.
+static void
+lrudel(struct inode *ip)
+{
+  ip->next->prev = ip->prev;
+  ip->prev->next = ip->next;
+  ip->next = ip->prev = 0;
+}
+
+// Add a page of unhashed inodes to the cache.
+// Caller holds icache.lock.
+static int
+igrow(void)
+{
+  struct inode *ip;
+  char *mem;
+
+  if((mem = kalloc()) == 0)
+    return -1;
+  memset(mem, 0, PGSIZE);
+  for(ip = (struct inode*)mem; ip < (struct inode*)mem + IPP; ip++){
+    initrwsleeplock(&ip->lock, "inode");
+    ip->inext = icache.all;
+    icache.all = ip;
+    // Unhashed inodes go to the LRU tail, to be used first.
+    ip->prev = icache.lru.prev;
+    ip->next = &icache.lru;
+    icache.lru.prev->next = ip;
+    icache.lru.prev = ip;
+  }
+  icache.n += IPP;
+  return 0;
+}
+
+// Return an idle inode taken off the LRU list and out of
+// its hash chain, growing the cache if it is small or has
+// no idle inode.
+static struct inode*
+irecycle(void)
+{
+  struct inode *ip, *p;
+  struct ibucket *bk;
+  uint dev, inum;
+
+  for(;;){
+    acquire(&icache.lock);
+    ip = icache.lru.prev;
+    if((ip == &icache.lru || (ip->inum && icache.n < icache.max)) &&
+       igrow() == 0)
+      ip = icache.lru.prev;
+    if(ip == &icache.lru)
+      panic("iget: no inodes");
+    if(ip->inum == 0){
+      lrudel(ip);
+      release(&icache.lock);
+      return ip;
+    }
+    // dev and inum cannot change while ip is on the LRU list.
+    dev = ip->dev;
+    inum = ip->inum;
+    release(&icache.lock);
+
+    bk = &icache.bucket[IHASH(dev, inum)];
+    acquire(&bk->lock);
+    acquire(&icache.lock);
+    if(ip->next && ip->ref == 0 && ip->dev == dev && ip->inum == inum){
+      lrudel(ip);
+      release(&icache.lock);
+      if(bk->head == ip)
+        bk->head = ip->hnext;
+      else {
+        for(p = bk->head; p->hnext != ip; p = p->hnext)
+          ;
+        p->hnext = ip->hnext;
+      }
+      ip->hnext = 0;
+      ip->dev = ip->inum = 0;
+      release(&bk->lock);
+      return ip;
+    }
+    // Someone took ip meanwhile; try again.
+    release(&icache.lock);
+    release(&bk->lock);
+  }
+}
+
+// Look for inode inum in use on device dev without locking
+// its bucket, and take a reference to it. The chain may change
+// under us, and an inode on it may be recycled for another
+// (dev, inum) until we hold a reference, so check again after
+// taking one. Return 0 if the inode is not found or is idle:
+// only iget under the bucket lock may take ref from 0.
+static struct inode*
+igetfast(uint dev, uint inum)
+{
+  struct inode *ip;
+  int n, r;
+
+  rcubegin();
+  ip = icache.bucket[IHASH(dev, inum)].head;
+  for(n = 0; ip && n < icache.n; ip = ip->hnext, n++){
+    if(ip->dev != dev || ip->inum != inum)
+      continue;
+    do {
+      if((r = ip->ref) == 0){
+        rcuend();
+        return 0;
+      }
+    } while(!__sync_bool_compare_and_swap(&ip->ref, r, r+1));
+    rcuend();
+    if(ip->dev == dev && ip->inum == inum)
+      return ip;
+    // Recycled before we got it.
+    iput(ip);
+    return 0;
+  }
+  rcuend();
+  return 0;
+}
+
 // Find the inode with number inum on device dev
 // and return the in-memory copy. Does not lock
 // the inode and does not read it from disk.
 static struct inode*
 iget(uint dev, uint inum)
 {
+  struct ibucket *bk;
   struct inode *ip, *empty;
 
-  acquire(&icache.lock);
+  if((ip = igetfast(dev, inum)) != 0)
+    return ip;
 
-  // Is the inode already cached?
+  bk = &icache.bucket[IHASH(dev, inum)];
   empty = 0;
-  for(ip = &icache.inode[0]; ip < &icache.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
-      release(&icache.lock);
-      return ip;
+  acquire(&bk->lock);
+  for(;;){
+    // Is the inode already cached?
+    for(ip = bk->head; ip; ip = ip->hnext){
+      if(ip->dev == dev && ip->inum == inum){
+        if(__sync_fetch_and_add(&ip->ref, 1) == 0){
+          acquire(&icache.lock);
+          lrudel(ip);
+          release(&icache.lock);
+        }
+        release(&bk->lock);
+        if(empty){
+          // Not needed after all.
+          acquire(&icache.lock);
+          lruput(empty);
+          release(&icache.lock);
+        }
+        return ip;
+      }
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
+    if(empty)
+      break;
+    // Recycle an inode cache entry. Another process may
+    // cache inum while bk is unlocked, so look again.
+    release(&bk->lock);
+    empty = irecycle();
+    acquire(&bk->lock);
   }
 
-  // Recycle an inode cache entry.
-  if(empty == 0)
-    panic("iget: no inodes");
-
   ip = empty;
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
-  release(&icache.lock);
+  ip->hnext = bk->head;
+  bk->head = ip;
+  release(&bk->lock);
 
   return ip;
 }
@@ -276,9 +595,8 @@ iget(uint dev, uint inum)
 struct inode*
 idup(struct inode *ip)
 {
-  acquire(&icache.lock);
-  ip->ref++;
-  release(&icache.lock);
+  // ip->ref is not 0, so no need for the bucket lock.
+  __sync_fetch_and_add(&ip->ref, 1);
   return ip;
 }
 
@@ -293,7 +611,7 @@ ilock(struct inode *ip)
   if(ip == 0 || ip->ref < 1)
     panic("ilock");
 
-  acquiresleep(&ip->lock);
+  acquirewrite(&ip->lock);
 
   if(ip->valid == 0){
     bp = bread(ip->dev, IBLOCK(ip->inum, sb));
@@ -305,6 +623,7 @@ ilock(struct inode *ip)
     ip->size = dip->size;
     memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
     brelse(bp);
+    ip->goal = 0;
     ip->valid = 1;
     if(ip->type == 0)
       panic("ilock: no type");
@@ -315,10 +634,37 @@ ilock(struct inode *ip)
 void
 iunlock(struct inode *ip)
 {
-  if(ip == 0 || !holdingsleep(&ip->lock) || ip->ref < 1)
+  if(ip == 0 || !holdingwrite(&ip->lock) || ip->ref < 1)
     panic("iunlock");
 
-  releasesleep(&ip->lock);
+  releasewrite(&ip->lock);
+}
+
+// Lock the given inode for reading only, sharing the lock
+// with other readers. Enough for readi, stati and dirlookup.
+void
+ilockshared(struct inode *ip)
+{
+  if(ip == 0 || ip->ref < 1)
+    panic("ilockshared");
+
+  acquireread(&ip->lock);
+  if(ip->valid == 0){
+    // Reading the inode from disk changes it.
+    releaseread(&ip->lock);
+    ilock(ip);
+    downgradewrite(&ip->lock);
+  }
+}
+
+// Unlock an inode locked by ilockshared.
+void
+iunlockshared(struct inode *ip)
+{
+  if(ip == 0 || ip->ref < 1)
+    panic("iunlockshared");
+
+  releaseread(&ip->lock);
 }
 
 // Drop a reference to an in-memory inode.
@@ -331,24 +677,38 @@ iunlock(struct inode *ip)
 void
 iput(struct inode *ip)
 {
-  acquiresleep(&ip->lock);
+  struct ibucket *bk;
+
+  bk = &icache.bucket[IHASH(ip->dev, ip->inum)];
+  acquirewrite(&ip->lock);
   if(ip->valid && ip->nlink == 0){
-    acquire(&icache.lock);
+    acquire(&bk->lock);
     int r = ip->ref;
-    release(&icache.lock);
+    release(&bk->lock);
     if(r == 1){
       // inode has no links and no other references: truncate and free.
+      if(ip->type == T_DIR)
+        dcpurge(ip->dev, ip->inum);
       itrunc(ip);
       ip->type = 0;
       iupdate(ip);
       ip->valid = 0;
+      acquire(&icache.lock);
+      if(ip->inum < icache.cursor[IGROUP(ip->inum, sb)])
+        icache.cursor[IGROUP(ip->inum, sb)] = ip->inum;
+      release(&icache.lock);
     }
   }
-  releasesleep(&ip->lock);
+  releasewrite(&ip->lock);
 
-  acquire(&icache.lock);
-  ip->ref--;
-  release(&icache.lock);
+  acquire(&bk->lock);
+  if(__sync_sub_and_fetch(&ip->ref, 1) == 0){
+    windrop(ip);
+    acquire(&icache.lock);
+    lruput(ip);
+    release(&icache.lock);
+  }
+  release(&bk->lock);
 }
 
 // Common idiom: unlock, then put.
@@ -365,38 +725,270 @@ iunlockput(struct inode *ip)
 // The content (data) associated with each inode is stored
 // in blocks on the disk. The first NDIRECT block numbers
 // are listed in ip->addrs[].  The next NINDIRECT blocks are
-// listed in block ip->addrs[NDIRECT].
+// listed in block ip->addrs[NDIRECT], the NDINDIRECT after
+// that in the blocks listed by ip->addrs[NDIRECT+1], and the
+// rest in a third level of blocks under ip->addrs[NDIRECT+2].
+// Small files never touch the indirect blocks.
+
+// Take ip's reservation window, if any, off its list.
+// Caller holds windows.lock.
+static void
+windrop1(struct inode *ip)
+{
+  struct inode **pp;
+
+  if(ip->rend == 0)
+    return;
+  for(pp = &windows.group[ip->rgroup]; *pp != ip; pp = &(*pp)->rlink)
+    ;
+  *pp = ip->rlink;
+  ip->rnext = ip->rend = 0;
+}
+
+// Drop ip's reservation window.
+static void
+windrop(struct inode *ip)
+{
+  acquire(&windows.lock);
+  windrop1(ip);
+  release(&windows.lock);
+}
+
+// Is block b in the reservation window of an inode other than ip?
+static int
+reserved(uint b, struct inode *ip)
+{
+  struct inode *p;
+  int g, g0;
+
+  g0 = b / BPG;
+  acquire(&windows.lock);
+  for(g = g0; g >= 0 && g >= g0 - 1; g--){
+    for(p = windows.group[g]; p; p = p->rlink){
+      if(p != ip && b >= p->rnext && b < p->rend){
+        release(&windows.lock);
+        return 1;
+      }
+    }
+  }
+  release(&windows.lock);
+  return 0;
+}
+
+// Allocate a block for ip: the next one of its reservation
+// window, else one after the last block it got, or else one
+// in the group of its inode. In the last two cases a new
+// window of the RESWIN-1 blocks after it is reserved.
+static uint
+iballoc(struct inode *ip)
+{
+  uint b, next;
+
+  acquire(&windows.lock);
+  next = ip->rnext < ip->rend ? ip->rnext : 0;
+  release(&windows.lock);
+
+  if(next == 0 || (b = balloc_at(ip->dev, next, ip)) == 0){
+    if(ip->goal == 0)
+      ip->goal = IGROUP(ip->inum, sb) * BPG;
+    b = balloc(ip->dev, ip->goal, ip);
+    next = 0;
+  }
+  ip->goal = b + 1;
+
+  acquire(&windows.lock);
+  if(next == 0){
+    windrop1(ip);
+    if(b + 1 < sb.size){
+      ip->rgroup = (b + 1) / BPG;
+      ip->rlink = windows.group[ip->rgroup];
+      windows.group[ip->rgroup] = ip;
+      ip->rend = min(b + RESWIN, sb.size);
+    }
+  }
+  ip->rnext = b + 1;
+  release(&windows.lock);
+  return b;
+}
+
+// Return entry i of the indirect block at addr,
+// allocating the block it names if necessary.
+static uint
+indirect(struct inode *ip, uint addr, uint i)
+{
+  uint *a;
+  struct buf *bp;
+
+  bp = bread(ip->dev, addr);
+  a = (uint*)bp->data;
+  if((addr = a[i]) == 0){
+    a[i] = addr = iballoc(ip);
+    log_write(bp);
+  }
+  brelse(bp);
+  return addr;
+}
 
 // Return the disk block address of the nth block in inode ip.
 // If there is no such block, bmap allocates one.
 static uint
 bmap(struct inode *ip, uint bn)
 {
-  uint addr, *a;
-  struct buf *bp;
+  uint addr, level, span;
 
   if(bn < NDIRECT){
     if((addr = ip->addrs[bn]) == 0)
-      ip->addrs[bn] = addr = balloc(ip->dev);
+      ip->addrs[bn] = addr = iballoc(ip);
     return addr;
   }
   bn -= NDIRECT;
 
-  if(bn < NINDIRECT){
-    // Load indirect block, allocating if necessary.
-    if((addr = ip->addrs[NDIRECT]) == 0)
-      ip->addrs[NDIRECT] = addr = balloc(ip->dev);
-    bp = bread(ip->dev, addr);
-    a = (uint*)bp->data;
-    if((addr = a[bn]) == 0){
-      a[bn] = addr = balloc(ip->dev);
-      log_write(bp);
+  // Find the tree that holds bn: level 1 is singly indirect,
+  // 2 doubly, 3 triply; span is the number of blocks in it.
+  span = NINDIRECT;
+  for(level = 1; level <= 3; level++){
+    if(bn < span)
+      break;
+    bn -= span;
+    span *= NINDIRECT;
+  }
+  if(level > 3)
+    panic("bmap: out of range");
+
+  // Load the top indirect block, allocating if necessary,
+  // then walk down one indirect block per level.
+  if((addr = ip->addrs[NDIRECT+level-1]) == 0)
+    ip->addrs[NDIRECT+level-1] = addr = iballoc(ip);
+  while(level-- > 0){
+    span /= NINDIRECT;
+    addr = indirect(ip, addr, bn / span);
+    bn %= span;
+  }
+  return addr;
+}
+
+// Extent-mapped inodes (T_EXTENT) list runs of contiguous
+// blocks instead of every block. The first NEXTENT runs are in
+// ip->addrs[]; ip->addrs[NADDRS-1] names an index block listing
+// up to NINDIRECT blocks of XPB more runs each. Files only grow
+// at the end, so a new block extends the last run whenever
+// iballoc hands out the disk block after it.
+
+// Find the run in x[0..n) holding block *bn, counted from the
+// start of x, and make *bn relative to that run. If x ends
+// first, return its first unused slot, or n if x is full.
+static uint
+xfind(struct extent *x, uint n, uint *bn)
+{
+  uint i;
+
+  for(i = 0; i < n && x[i].len; i++){
+    if(*bn < x[i].len)
+      return i;
+    *bn -= x[i].len;
+  }
+  return i;
+}
+
+// Return block bn of run x[i] as found by xfind, and set *run
+// to the number of blocks left in the run. If x[i] is unused,
+// the block is the one just past the end of the file: allocate
+// it, extending x[i-1] if the block follows it, and set *dirty
+// because x changed.
+static uint
+xget(struct inode *ip, struct extent *x, uint i, uint bn, uint *run, int *dirty)
+{
+  uint b;
+
+  *dirty = 0;
+  if(x[i].len){
+    *run = x[i].len - bn;
+    return x[i].start + bn;
+  }
+  if(bn != 0)
+    panic("emap: hole");
+  *run = 1;
+  *dirty = 1;
+  b = iballoc(ip);
+  if(i > 0 && b == x[i-1].start + x[i-1].len){
+    x[i-1].len++;
+    return b;
+  }
+  x[i].start = b;
+  x[i].len = 1;
+  return b;
+}
+
+// Like bmap, for an extent inode. Also set *run to the number of
+// contiguous blocks mapped from bn on.
+static uint
+emap(struct inode *ip, uint bn, uint *run)
+{
+  uint i, j, addr, *a;
+  struct buf *ib, *xb;
+  struct extent *x;
+  int dirty;
+
+  x = (struct extent*)ip->addrs;
+  if((i = xfind(x, NEXTENT, &bn)) < NEXTENT)
+    return xget(ip, x, i, bn, run, &dirty);
+
+  if((addr = ip->addrs[NADDRS-1]) == 0)
+    ip->addrs[NADDRS-1] = addr = iballoc(ip);
+  ib = bread(ip->dev, addr);
+  a = (uint*)ib->data;
+  for(j = 0; j < NINDIRECT; j++){
+    if(a[j] == 0){
+      a[j] = iballoc(ip);
+      log_write(ib);
     }
-    brelse(bp);
-    return addr;
+    xb = bread(ip->dev, a[j]);
+    x = (struct extent*)xb->data;
+    if((i = xfind(x, XPB, &bn)) < XPB){
+      brelse(ib);
+      addr = xget(ip, x, i, bn, run, &dirty);
+      if(dirty)
+        log_write(xb);
+      brelse(xb);
+      return addr;
+    }
+    brelse(xb);
   }
+  panic("emap: out of range");
+}
+
+// Free the blocks of the runs in x[0..n).
+static void
+xfree(struct inode *ip, struct extent *x, uint n)
+{
+  uint i, b;
 
-  panic("bmap: out of range");
+  for(i = 0; i < n && x[i].len; i++)
+    for(b = 0; b < x[i].len; b++)
+      bfree(ip->dev, x[i].start + b);
+}
+
+// Free the indirect block addr and everything below it;
+// level 1 blocks list data blocks.
+static void
+ifree(struct inode *ip, uint addr, int level)
+{
+  int j;
+  struct buf *bp;
+  uint *a;
+
+  bp = bread(ip->dev, addr);
+  a = (uint*)bp->data;
+  for(j = 0; j < NINDIRECT; j++){
+    if(a[j] == 0)
+      continue;
+    if(level > 1)
+      ifree(ip, a[j], level-1);
+    else
+      bfree(ip->dev, a[j]);
+  }
+  brelse(bp);
+  bfree(ip->dev, addr);
 }
 
 // Truncate inode (discard contents).
@@ -407,10 +999,32 @@ bmap(struct inode *ip, uint bn)
 static void
 itrunc(struct inode *ip)
 {
-  int i, j;
-  struct buf *bp;
+  int i;
+  struct buf *bp, *xb;
   uint *a;
 
+  windrop(ip);
+
+  if(ip->type == T_EXTENT){
+    xfree(ip, (struct extent*)ip->addrs, NEXTENT);
+    if(ip->addrs[NADDRS-1]){
+      bp = bread(ip->dev, ip->addrs[NADDRS-1]);
+      a = (uint*)bp->data;
+      for(i = 0; i < NINDIRECT && a[i]; i++){
+        xb = bread(ip->dev, a[i]);
+        xfree(ip, (struct extent*)xb->data, XPB);
+        brelse(xb);
+        bfree(ip->dev, a[i]);
+      }
+      brelse(bp);
+      bfree(ip->dev, ip->addrs[NADDRS-1]);
+    }
+    memset(ip->addrs, 0, sizeof(ip->addrs));
+    ip->size = 0;
+    iupdate(ip);
+    return;
+  }
+
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
       bfree(ip->dev, ip->addrs[i]);
@@ -418,16 +1032,11 @@ itrunc(struct inode *ip)
     }
   }
 
-  if(ip->addrs[NDIRECT]){
-    bp = bread(ip->dev, ip->addrs[NDIRECT]);
-    a = (uint*)bp->data;
-    for(j = 0; j < NINDIRECT; j++){
-      if(a[j])
-        bfree(ip->dev, a[j]);
+  for(i = NDIRECT; i < NADDRS; i++){
+    if(ip->addrs[i]){
+      ifree(ip, ip->addrs[i], i-NDIRECT+1);
+      ip->addrs[i] = 0;
     }
-    brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT]);
-    ip->addrs[NDIRECT] = 0;
   }
 
   ip->size = 0;
@@ -446,6 +1055,55 @@ stati(struct inode *ip, struct stat *st)
   st->size = ip->size;
 }
 
+// Lock the bufs holding bytes off..off+n of ip into bs[] and
+// return how many there are: as many of the blocks, up to NRUN,
+// as are contiguous on disk and the cache can spare, read with
+// one disk request.
+static int
+iblocks(struct inode *ip, uint off, uint n, struct buf **bs)
+{
+  uint addr, run, want, bn;
+
+  want = (off%BSIZE + n + BSIZE-1) / BSIZE;
+  if(want > NRUN)
+    want = NRUN;
+  bn = off/BSIZE;
+  if(ip->type == T_EXTENT){
+    addr = emap(ip, bn, &run);
+    if(run > want)
+      run = want;
+  } else {
+    addr = bmap(ip, bn);
+    for(run = 1; run < want; run++)
+      if(bmap(ip, bn + run) != addr + run)
+        break;
+  }
+  return breadn(ip->dev, addr, run, bs);
+}
+
+// Allocate blocks bn..bn+n-1 of ip ahead of the writes that
+// will fill them, so that they come out contiguous. Blocks
+// past the end of the file stay allocated until itrunc.
+// Caller must hold ip->lock and be inside a transaction.
+int
+ireserve(struct inode *ip, uint bn, uint n)
+{
+  uint run;
+
+  if(ip->type != T_FILE && ip->type != T_EXTENT)
+    return -1;
+  if(bn + n < bn || bn + n > MAXFILE)
+    return -1;
+  for(; n > 0; bn++, n--){
+    if(ip->type == T_EXTENT)
+      emap(ip, bn, &run);
+    else
+      bmap(ip, bn);
+  }
+  iupdate(ip);
+  return 0;
+}
+
 //PAGEBREAK!
 // Read data from inode.
 // Caller must hold ip->lock.
@@ -453,7 +1111,8 @@ int
 readi(struct inode *ip, char *dst, uint off, uint n)
 {
   uint tot, m;
-  struct buf *bp;
+  struct buf *bs[NRUN];
+  int i, nb;
 
   if(ip->type == T_DEV){
     if(ip->major < 0 || ip->major >= NDEV || !devsw[ip->major].read)
@@ -466,15 +1125,52 @@ readi(struct inode *ip, char *dst, uint off, uint n)
   if(off + n > ip->size)
     n = ip->size - off;
 
-  for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
-    m = min(n - tot, BSIZE - off%BSIZE);
-    memmove(dst, bp->data + off%BSIZE, m);
-    brelse(bp);
+  for(tot=0; tot<n; ){
+    nb = iblocks(ip, off, n - tot, bs);
+    for(i = 0; i < nb; i++, tot+=m, off+=m, dst+=m){
+      m = min(n - tot, BSIZE - off%BSIZE);
+      memmove(dst, bs[i]->data + off%BSIZE, m);
+      brelse(bs[i]);
+    }
   }
   return n;
 }
 
+// Hand bytes off..off+n of ip to fn straight from the buffer
+// cache, a block at a time, and return how many fn took. Stops
+// when fn takes less than it is offered. fn must not sleep.
+// Caller must hold ip->lock.
+int
+readifn(struct inode *ip, uint off, uint n, int (*fn)(void*, char*, int), void *arg)
+{
+  uint tot, m;
+  struct buf *bs[NRUN];
+  int i, nb, r;
+
+  if(ip->type != T_FILE && ip->type != T_EXTENT)
+    return -1;
+  if(off > ip->size || off + n < off)
+    return -1;
+  if(off + n > ip->size)
+    n = ip->size - off;
+
+  for(tot=0; tot<n; ){
+    nb = iblocks(ip, off, n - tot, bs);
+    for(i = 0; i < nb; i++){
+      m = min(n - tot, BSIZE - off%BSIZE);
+      r = m > 0 ? fn(arg, (char*)bs[i]->data + off%BSIZE, m) : 0;
+      if(r < 0)
+        r = 0;
+      tot += r;
+      off += r;
+      if(r < m)
+        n = tot;  // release the rest and stop
+      brelse(bs[i]);
+    }
+  }
+  return tot;
+}
+
 // PAGEBREAK!
 // Write data to inode.
 // Caller must hold ip->lock.
@@ -482,7 +1178,8 @@ int
 writei(struct inode *ip, char *src, uint off, uint n)
 {
   uint tot, m;
-  struct buf *bp;
+  struct buf *bs[NRUN];
+  int i, nb;
 
   if(ip->type == T_DEV){
     if(ip->major < 0 || ip->major >= NDEV || !devsw[ip->major].write)
@@ -492,15 +1189,23 @@ writei(struct inode *ip, char *src, uint off, uint n)
 
   if(off > ip->size || off + n < off)
     return -1;
-  if(off + n > MAXFILE*BSIZE)
+  if((off + n)/BSIZE > MAXFILE)
     return -1;
 
-  for(tot=0; tot<n; tot+=m, off+=m, src+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
-    m = min(n - tot, BSIZE - off%BSIZE);
-    memmove(bp->data + off%BSIZE, src, m);
-    log_write(bp);
-    brelse(bp);
+  for(tot=0; tot<n; ){
+    nb = iblocks(ip, off, n - tot, bs);
+    for(i = 0; i < nb; i++, tot+=m, off+=m, src+=m){
+      m = min(n - tot, BSIZE - off%BSIZE);
+      memmove(bs[i]->data + off%BSIZE, src, m);
+      // File data may be written back later, unless the log
+      // holds an older copy that checkpoint() would install
+      // on top of it.
+      if(WRITEBACK && ip->type != T_DIR && !bpinned(bs[i]))
+        bdwrite(bs[i], ip->inum);
+      else
+        log_write(bs[i]);
+      brelse(bs[i]);
+    }
   }
 
   if(n > 0 && off > ip->size){
@@ -519,6 +1224,296 @@ namecmp(const char *s, const char *t)
   return strncmp(s, t, DIRSIZ);
 }
 
+// Directories of more than one block are hashed (see fs.h).
+// Block 0 keeps "." and ".." followed by the index, and each
+// leaf block holds the names whose hashes fall in its range.
+// dirlink converts a linear directory when its first block
+// fills up; larger linear directories stay linear.
+
+#define DXHEAD(bp) ((struct dxhead*)((struct dirent*)(bp)->data + 2))
+#define DXENT(h)   ((struct dxentry*)((h) + 1))
+
+// Leaf splits one dirlink may make. Each writes one more leaf;
+// with the leaf it started from, block 0, the indirect block,
+// the bitmap, the super block and the inodes and first block
+// of a new directory, two keep mkdir within MAXOPBLOCKS.
+#define DXSPLITS 2
+
+// FNV-1a hash of a directory entry name.
+static uint
+dxhash(char *name)
+{
+  uint h;
+  int i;
+
+  h = 2166136261;
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = (h ^ (uchar)name[i]) * 16777619;
+  return h;
+}
+
+// Lock and return block bn of directory dp,
+// allocating it if dp does not have it yet.
+static struct buf*
+dirblock(struct inode *dp, uint bn)
+{
+  return bread(dp->dev, bmap(dp, bn));
+}
+
+// Find the entry for name in directory block bp,
+// or a free entry if name is 0.
+static struct dirent*
+dirscan(struct buf *bp, char *name)
+{
+  struct dirent *de;
+
+  for(de = (struct dirent*)bp->data; de < (struct dirent*)(bp->data + BSIZE); de++){
+    if(name == 0 && de->inum == 0)
+      return de;
+    if(name && de->inum && namecmp(name, de->name) == 0)
+      return de;
+  }
+  return 0;
+}
+
+// If dp is hashed, return its block 0, locked.
+static struct buf*
+dxroot(struct inode *dp)
+{
+  struct buf *bp;
+  struct dxhead *h;
+
+  if(dp->size < 3*BSIZE)
+    return 0;
+  bp = dirblock(dp, 0);
+  h = DXHEAD(bp);
+  if(h->inum == 0 && h->magic == DXMAGIC)
+    return bp;
+  brelse(bp);
+  return 0;
+}
+
+// Index of the leaf whose range holds hash.
+static uint
+dxfind(struct dxhead *h, uint hash)
+{
+  struct dxentry *e;
+  uint lo, hi, mid;
+
+  e = DXENT(h);
+  lo = 0;
+  hi = h->nleaf;
+  while(hi - lo > 1){
+    mid = (lo + hi) / 2;
+    if(e[mid].hash <= hash)
+      lo = mid;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+// Look up name in hashed directory dp, whose block 0 is locked
+// in bp, and release bp. Return the inum or 0, and set *poff.
+static uint
+dxlookup(struct inode *dp, struct buf *bp, char *name, uint *poff)
+{
+  struct dxhead *h;
+  struct dirent *de;
+  uint bn, inum;
+
+  bn = 0;
+  if(namecmp(name, ".") != 0 && namecmp(name, "..") != 0){
+    h = DXHEAD(bp);
+    bn = DXENT(h)[dxfind(h, dxhash(name))].block;
+    brelse(bp);
+    bp = dirblock(dp, bn);
+  }
+  inum = 0;
+  if((de = dirscan(bp, name)) != 0){
+    inum = de->inum;
+    *poff = bn*BSIZE + ((char*)de - (char*)bp->data);
+  }
+  brelse(bp);
+  return inum;
+}
+
+// Split leaf i of hashed directory dp, whose block 0 is locked
+// with index h and leaf i in lbp: names hashing to the upper
+// half of the leaf's range move to a new leaf at the end of dp.
+static int
+dxsplit(struct inode *dp, struct dxhead *h, uint i, struct buf *lbp)
+{
+  struct dxentry *e;
+  struct dirent *de, *nde;
+  struct buf *nbp;
+  uint lo, hi, mid, nb;
+
+  e = DXENT(h);
+  lo = e[i].hash;
+  hi = i+1 < h->nleaf ? e[i+1].hash : 0;  // 0 stands for 2^32
+  if(hi - lo == 1 || h->nleaf >= NDXENTRY)
+    return -1;
+  mid = lo + (hi - 1 - lo)/2 + 1;
+
+  nb = dp->size / BSIZE;
+  nbp = dirblock(dp, nb);
+  dp->size += BSIZE;
+  iupdate(dp);
+  nde = (struct dirent*)nbp->data;
+  for(de = (struct dirent*)lbp->data; de < (struct dirent*)(lbp->data + BSIZE); de++){
+    if(de->inum && dxhash(de->name) >= mid){
+      *nde++ = *de;
+      memset(de, 0, sizeof(*de));
+    }
+  }
+  log_write(lbp);
+  log_write(nbp);
+  brelse(nbp);
+
+  memmove(&e[i+2], &e[i+1], (h->nleaf - i - 1) * sizeof(*e));
+  memset(&e[i+1], 0, sizeof(*e));
+  e[i+1].hash = mid;
+  e[i+1].block = nb;
+  h->nleaf++;
+
+  // Entries moved; forget their cached offsets.
+  dcpurge(dp->dev, dp->inum);
+  return 0;
+}
+
+// Add (name, inum) to hashed directory dp, whose block 0 is
+// locked in bp, and release bp. Fails if name's leaf is still
+// full after DXSPLITS splits, or cannot be split; the splits
+// made stand, so trying again gets further.
+static int
+dxlink(struct inode *dp, struct buf *bp, char *name, uint inum)
+{
+  struct dxhead *h;
+  struct dirent *de;
+  struct buf *lbp;
+  uint i, hash, bn, off;
+  int splits;
+
+  h = DXHEAD(bp);
+  hash = dxhash(name);
+  for(splits = 0; ; splits++){
+    i = dxfind(h, hash);
+    bn = DXENT(h)[i].block;
+    lbp = dirblock(dp, bn);
+    if((de = dirscan(lbp, 0)) != 0){
+      strncpy(de->name, name, DIRSIZ);
+      de->inum = inum;
+      off = bn*BSIZE + ((char*)de - (char*)lbp->data);
+      log_write(lbp);
+      brelse(lbp);
+      brelse(bp);
+      dcenter(dp->dev, dp->inum, name, inum, off);
+      return 0;
+    }
+    // Leaf is full.
+    if(splits == DXSPLITS || dxsplit(dp, h, i, lbp) < 0){
+      brelse(lbp);
+      break;
+    }
+    log_write(bp);
+    brelse(lbp);
+  }
+  brelse(bp);
+  return -1;
+}
+
+// Turn linear directory dp, with one full block, into a hashed
+// directory with two leaves.
+static int
+dxbuild(struct inode *dp)
+{
+  struct buf *bp, *lbp[2];
+  struct dirent *d, *next[2];
+  struct dxhead *h;
+  struct dxentry *e;
+  int j, k;
+
+  bp = dirblock(dp, 0);
+  d = (struct dirent*)bp->data;
+  if(d[0].inum == 0 || namecmp(d[0].name, ".") != 0 ||
+     d[1].inum == 0 || namecmp(d[1].name, "..") != 0){
+    brelse(bp);
+    return -1;
+  }
+  for(k = 0; k < 2; k++){
+    lbp[k] = dirblock(dp, 1+k);
+    next[k] = (struct dirent*)lbp[k]->data;
+  }
+  for(j = 2; j < DPB; j++){
+    if(d[j].inum == 0)
+      continue;
+    k = dxhash(d[j].name) >= 0x80000000;
+    *next[k]++ = d[j];
+  }
+  memset(&d[2], 0, BSIZE - 2*sizeof(*d));
+  h = DXHEAD(bp);
+  h->magic = DXMAGIC;
+  h->nleaf = 2;
+  e = DXENT(h);
+  e[0].hash = 0;
+  e[0].block = 1;
+  e[1].hash = 0x80000000;
+  e[1].block = 2;
+  for(k = 0; k < 2; k++){
+    log_write(lbp[k]);
+    brelse(lbp[k]);
+  }
+  log_write(bp);
+  brelse(bp);
+  dp->size = 3*BSIZE;
+  iupdate(dp);
+  dcpurge(dp->dev, dp->inum);
+  return 0;
+}
+
+// Fill ds[0..n) with the entries of directory dp from byte
+// offset *off on, with the stat of each entry's inode, and
+// advance *off past them. Reads the inodes from the buffer
+// cache without locking them; the cache is write-through.
+// Returns the number of entries filled. Caller must hold dp->lock.
+int
+dirstats(struct inode *dp, uint *off, struct dirstat *ds, int n)
+{
+  struct dirent de[16];
+  struct dinode *dip;
+  struct buf *bp;
+  int i, j, r;
+
+  if(dp->type != T_DIR)
+    return -1;
+  i = 0;
+  while(i < n && *off < dp->size){
+    r = readi(dp, (char*)de, *off, sizeof(de));
+    if(r <= 0)
+      break;
+    for(j = 0; j < r/sizeof(de[0]) && i < n; j++){
+      *off += sizeof(de[0]);
+      if(de[j].inum == 0)
+        continue;
+      bp = bread(dp->dev, IBLOCK(de[j].inum, sb));
+      dip = (struct dinode*)bp->data + de[j].inum%IPB;
+      if(dip->type != 0){  // else removed meanwhile
+        memmove(ds[i].name, de[j].name, DIRSIZ);
+        ds[i].name[DIRSIZ] = 0;
+        ds[i].st.dev = dp->dev;
+        ds[i].st.ino = de[j].inum;
+        ds[i].st.type = dip->type;
+        ds[i].st.nlink = dip->nlink;
+        ds[i].st.size = dip->size;
+        i++;
+      }
+      brelse(bp);
+    }
+  }
+  return i;
+}
+
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
 struct inode*
@@ -526,25 +1521,38 @@ dirlookup(struct inode *dp, char *name, uint *poff)
 {
   uint off, inum;
   struct dirent de;
+  struct buf *bp;
 
   if(dp->type != T_DIR)
     panic("dirlookup not DIR");
 
-  for(off = 0; off < dp->size; off += sizeof(de)){
-    if(readi(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
-      panic("dirlookup read");
-    if(de.inum == 0)
-      continue;
-    if(namecmp(name, de.name) == 0){
-      // entry matches path element
-      if(poff)
-        *poff = off;
-      inum = de.inum;
-      return iget(dp->dev, inum);
+  if(dclookup(dp->dev, dp->inum, name, &inum, poff))
+    return inum ? iget(dp->dev, inum) : 0;
+
+  inum = 0;
+  off = 0;
+  if((bp = dxroot(dp)) != 0)
+    inum = dxlookup(dp, bp, name, &off);
+  else {
+    for(off = 0; off < dp->size; off += sizeof(de)){
+      if(readi(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
+        panic("dirlookup read");
+      if(de.inum == 0)
+        continue;
+      if(namecmp(name, de.name) == 0){
+        // entry matches path element
+        inum = de.inum;
+        break;
+      }
     }
   }
 
-  return 0;
+  dcenter(dp->dev, dp->inum, name, inum, off);
+  if(inum == 0)
+    return 0;
+  if(poff)
+    *poff = off;
+  return iget(dp->dev, inum);
 }
 
 // Write a new directory entry (name, inum) into the directory dp.
@@ -554,6 +1562,7 @@ dirlink(struct inode *dp, char *name, uint inum)
   int off;
   struct dirent de;
   struct inode *ip;
+  struct buf *bp;
 
   // Check that name is not present.
   if((ip = dirlookup(dp, name, 0)) != 0){
@@ -561,6 +1570,9 @@ dirlink(struct inode *dp, char *name, uint inum)
     return -1;
   }
 
+  if((bp = dxroot(dp)) != 0)
+    return dxlink(dp, bp, name, inum);
+
   // Look for an empty dirent.
   for(off = 0; off < dp->size; off += sizeof(de)){
     if(readi(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
@@ -569,10 +1581,15 @@ dirlink(struct inode *dp, char *name, uint inum)
       break;
   }
 
+  // A full one-block directory becomes hashed.
+  if(off == BSIZE && dp->size == BSIZE && dxbuild(dp) == 0)
+    return dxlink(dp, dxroot(dp), name, inum);
+
   strncpy(de.name, name, DIRSIZ);
   de.inum = inum;
   if(writei(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
     panic("dirlink");
+  dcenter(dp->dev, dp->inum, name, inum, off);
 
   return 0;
 }
@@ -625,6 +1642,7 @@ static struct inode*
 namex(char *path, int nameiparent, char *name)
 {
   struct inode *ip, *next;
+  uint inum, inum1;
 
   if(*path == '/')
     ip = iget(ROOTDEV, ROOTINO);
@@ -632,21 +1650,43 @@ namex(char *path, int nameiparent, char *name)
     ip = idup(myproc()->cwd);
 
   while((path = skipelem(path, name)) != 0){
-    ilock(ip);
+    // Only directories have cache entries, so a hit needs
+    // neither ip's lock nor its type.
+    if(*path != '\0' || !nameiparent){
+      if(dclookup(ip->dev, ip->inum, name, &inum, 0)){
+        if(inum == 0){
+          iput(ip);
+          return 0;
+        }
+        // The name may be unlinked, and the inode freed, before
+        // iget takes its reference. Believe the cache only if it
+        // still says the same once the reference is held; an
+        // unlink after that leaves the inode to our iput.
+        next = iget(ip->dev, inum);
+        if(dclookup(ip->dev, ip->inum, name, &inum1, 0) && inum1 == inum){
+          iput(ip);
+          ip = next;
+          continue;
+        }
+        iput(next);
+      }
+    }
+    ilockshared(ip);
     if(ip->type != T_DIR){
-      iunlockput(ip);
+      iunlockshared(ip);
+      iput(ip);
       return 0;
     }
     if(nameiparent && *path == '\0'){
       // Stop one level early.
-      iunlock(ip);
+      iunlockshared(ip);
       return ip;
     }
-    if((next = dirlookup(ip, name, 0)) == 0){
-      iunlockput(ip);
+    next = dirlookup(ip, name, 0);
+    iunlockshared(ip);
+    iput(ip);
+    if(next == 0)
       return 0;
-    }
-    iunlockput(ip);
     ip = next;
   }
   if(nameiparent){
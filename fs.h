@@ -3,14 +3,20 @@
 
 
 #define ROOTINO 1  // root i-number
-#define BSIZE 512  // block size
+#define BSIZE 4096  // block size
 
 // Disk layout:
 // [ boot block | super block | log | inode blocks |
 //                                          free bit map | data blocks]
 //
 // mkfs computes the super block and builds an initial file system. The
-// super block describes the disk layout:
+// super block describes the disk layout, and counts the free blocks
+// in each allocation group of BPG blocks. The inodes are split into
+// as many groups, and the allocator keeps a file's blocks in the
+// group of its inode.
+#define BPG 512          // blocks per allocation group
+#define MAXGROUPS 64     // max groups the super block describes
+
 struct superblock {
   uint size;         // Size of file system image (blocks)
   uint nblocks;      // Number of data blocks
@@ -19,11 +25,26 @@ struct superblock {
   uint logstart;     // Block number of first log block
   uint inodestart;   // Block number of first inode block
   uint bmapstart;    // Block number of first free map block
+  uint ngroups;      // Number of allocation groups
+  uint gfree[MAXGROUPS]; // Free blocks in each group
 };
 
-#define NDIRECT 12
+#define NDIRECT 10
 #define NINDIRECT (BSIZE / sizeof(uint))
-#define MAXFILE (NDIRECT + NINDIRECT)
+#define NDINDIRECT (NINDIRECT * NINDIRECT)
+#define NTINDIRECT (NDINDIRECT * NINDIRECT)
+#define MAXFILE (NDIRECT + NINDIRECT + NDINDIRECT + NTINDIRECT)
+#define NADDRS (NDIRECT+3)
+
+// Extent-mapped files (T_EXTENT) use addrs[] as NEXTENT runs
+// of contiguous blocks, in file order, followed by the address
+// of an index block that lists blocks of XPB more runs.
+struct extent {
+  uint start;  // first disk block of the run
+  uint len;    // number of blocks in the run
+};
+#define NEXTENT ((NADDRS-1) / 2)
+#define XPB (BSIZE / sizeof(struct extent))
 
 // On-disk inode structure
 struct dinode {
@@ -32,7 +53,7 @@ struct dinode {
   short minor;          // Minor device number (T_DEV only)
   short nlink;          // Number of links to inode in file system
   uint size;            // Size of file (bytes)
-  uint addrs[NDIRECT+1];   // Data block addresses
+  uint addrs[NADDRS];   // Data block addresses
 };
 
 // Inodes per block.
@@ -47,6 +68,10 @@ struct dinode {
 // Block of free map containing bit for block b
 #define BBLOCK(b, sb) (b/BPB + sb.bmapstart)
 
+// Inodes per allocation group, and the group of inode i
+#define IPG(sb)       (((sb).ninodes + (sb).ngroups - 1) / (sb).ngroups)
+#define IGROUP(i, sb) ((i) / IPG(sb))
+
 // Directory is a file containing a sequence of dirent structures.
 #define DIRSIZ 14
 
@@ -55,3 +80,30 @@ struct dirent {
   char name[DIRSIZ];
 };
 
+// Dirents per block
+#define DPB           (BSIZE / sizeof(struct dirent))
+
+// A directory of more than one block may be hashed. Its block 0
+// then holds "." and "..", a dxhead, and an index of leaf blocks
+// sorted by the lowest name hash each leaf holds. The index
+// slots are dirent-sized with inum 0, so code that reads a
+// directory linearly only sees the entries in the leaves.
+#define DXMAGIC 0x7864
+
+struct dxhead {
+  ushort inum;     // always 0
+  ushort magic;    // DXMAGIC
+  uint nleaf;      // index entries in use
+  uint pad[2];
+};
+
+struct dxentry {
+  ushort inum;     // always 0
+  ushort pad;
+  uint hash;       // lowest hash in the leaf
+  uint block;      // leaf's block number within the directory
+  uint pad2;
+};
+
+#define NDXENTRY (DPB - 3)
+
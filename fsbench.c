@@ -0,0 +1,72 @@
+// File throughput benchmark: write a file sequentially,
+// fsync it, read it back, and report KB per tick for each.
+// Usage: fsbench [kb [e|f]]; "e" makes an extent file,
+// "f" fallocates the file before writing it.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fs.h"
+#include "fcntl.h"
+
+char buf[8192];
+
+void
+report(char *what, int kb, int ticks)
+{
+  if(ticks == 0)
+    ticks = 1;
+  printf(1, "fsbench: %s %d KB in %d ticks, %d KB/tick\n",
+         what, kb, ticks, kb / ticks);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int fd, kb, i, n, t0, mode;
+
+  kb = 2048;
+  if(argc > 1)
+    kb = atoi(argv[1]);
+  mode = O_CREATE | O_RDWR;
+  if(argc > 2 && argv[2][0] == 'e')
+    mode |= O_EXTENT;
+  n = kb * 1024 / sizeof(buf);
+  kb = n * sizeof(buf) / 1024;
+  printf(1, "fsbench: BSIZE %d\n", BSIZE);
+
+  unlink("fsbench.tmp");
+  if((fd = open("fsbench.tmp", mode)) < 0){
+    printf(1, "fsbench: cannot create file\n");
+    exit();
+  }
+  memset(buf, 'x', sizeof(buf));
+  t0 = vuptime();
+  if(argc > 2 && argv[2][0] == 'f')
+    fallocate(fd, 0, kb * 1024);
+  for(i = 0; i < n; i++){
+    if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+      printf(1, "fsbench: write failed\n");
+      exit();
+    }
+  }
+  fsync(fd);
+  report("write", kb, vuptime() - t0);
+  close(fd);
+
+  if((fd = open("fsbench.tmp", O_RDONLY)) < 0){
+    printf(1, "fsbench: cannot open file\n");
+    exit();
+  }
+  t0 = vuptime();
+  for(i = 0; i < n; i++){
+    if(read(fd, buf, sizeof(buf)) != sizeof(buf)){
+      printf(1, "fsbench: read failed\n");
+      exit();
+    }
+  }
+  report("read", kb, vuptime() - t0);
+  close(fd);
+  unlink("fsbench.tmp");
+  exit();
+}
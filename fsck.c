@@ -0,0 +1,377 @@
+// Check an xv6 file system image: the bitmap against the blocks
+// the inodes use, the group free counts, the link counts against
+// the directory entries, and the shape of each directory.
+// Run it on a host, on an image that is not in use.
+
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define stat xv6_stat  // avoid clash with host struct stat
+#include "types.h"
+#include "fs.h"
+#include "stat.h"
+#undef stat
+
+uchar *img;
+uint nimg;          // blocks in the image
+struct superblock sb;
+uint datastart;     // first data block
+uint *owner;        // inode using each block, or 0
+ushort *refs;       // directory entries naming each inode
+int errors;
+
+ushort
+xshort(ushort x)
+{
+  uchar *a = (uchar*)&x;
+  return a[0] | (a[1] << 8);
+}
+
+uint
+xint(uint x)
+{
+  uchar *a = (uchar*)&x;
+  return a[0] | (a[1] << 8) | (a[2] << 16) | ((uint)a[3] << 24);
+}
+
+void
+problem(char *fmt, ...)
+{
+  va_list ap;
+
+  va_start(ap, fmt);
+  vprintf(fmt, ap);
+  va_end(ap);
+  printf("\n");
+  errors++;
+}
+
+uchar*
+block(uint b)
+{
+  return img + (size_t)b*BSIZE;
+}
+
+struct dinode*
+dinode(uint inum)
+{
+  return (struct dinode*)block(inum/IPB + sb.inodestart) + inum%IPB;
+}
+
+// Note that inode inum uses block b.
+int
+use(uint inum, uint b)
+{
+  if(b < datastart || b >= sb.size){
+    problem("inode %u: block %u is outside the data area", inum, b);
+    return -1;
+  }
+  if(owner[b]){
+    problem("block %u used by inodes %u and %u", b, owner[b], inum);
+    return -1;
+  }
+  owner[b] = inum;
+  return 0;
+}
+
+// Mark the indirect block addr and everything below it;
+// level 1 blocks list data blocks.
+void
+useindirect(uint inum, uint addr, int level)
+{
+  uint j, *a;
+
+  if(use(inum, addr) < 0)
+    return;
+  a = (uint*)block(addr);
+  for(j = 0; j < NINDIRECT; j++){
+    if(a[j] == 0)
+      continue;
+    if(level > 1)
+      useindirect(inum, xint(a[j]), level-1);
+    else
+      use(inum, xint(a[j]));
+  }
+}
+
+// Mark the blocks of n runs; return how many blocks they hold.
+uint
+useextents(uint inum, struct extent *x, uint n)
+{
+  uint i, b, tot;
+
+  tot = 0;
+  for(i = 0; i < n && x[i].len; i++){
+    for(b = 0; b < xint(x[i].len); b++)
+      use(inum, xint(x[i].start) + b);
+    tot += xint(x[i].len);
+  }
+  return tot;
+}
+
+// Return the disk block holding block bn of inode dip, or 0.
+uint
+bmap(struct dinode *dip, uint bn)
+{
+  uint span, x, i, *a;
+  int level;
+  struct extent *e;
+
+  if(xshort(dip->type) == T_EXTENT){
+    e = (struct extent*)dip->addrs;
+    for(i = 0; i < NEXTENT && e[i].len; i++){
+      if(bn < xint(e[i].len))
+        return xint(e[i].start) + bn;
+      bn -= xint(e[i].len);
+    }
+    if(i < NEXTENT || dip->addrs[NADDRS-1] == 0)
+      return 0;
+    a = (uint*)block(xint(dip->addrs[NADDRS-1]));
+    for(x = 0; x < NINDIRECT && a[x]; x++){
+      e = (struct extent*)block(xint(a[x]));
+      for(i = 0; i < XPB && e[i].len; i++){
+        if(bn < xint(e[i].len))
+          return xint(e[i].start) + bn;
+        bn -= xint(e[i].len);
+      }
+      if(i < XPB)
+        return 0;
+    }
+    return 0;
+  }
+
+  if(bn < NDIRECT)
+    return xint(dip->addrs[bn]);
+  bn -= NDIRECT;
+  span = NINDIRECT;
+  for(level = 1; bn >= span; level++){
+    bn -= span;
+    span *= NINDIRECT;
+  }
+  x = xint(dip->addrs[NDIRECT+level-1]);
+  while(x && level-- > 0){
+    span /= NINDIRECT;
+    if(x < datastart || x >= sb.size)
+      return 0;
+    x = xint(((uint*)block(x))[bn / span]);
+    bn %= span;
+  }
+  return x;
+}
+
+// Mark every block of inode inum and check that the
+// blocks below its size are all there.
+void
+checkblocks(uint inum, struct dinode *dip)
+{
+  uint i, a, n, *idx;
+
+  if(xshort(dip->type) == T_EXTENT){
+    useextents(inum, (struct extent*)dip->addrs, NEXTENT);
+    if((a = xint(dip->addrs[NADDRS-1])) != 0 && use(inum, a) == 0){
+      idx = (uint*)block(a);
+      for(i = 0; i < NINDIRECT && idx[i]; i++)
+        if(use(inum, xint(idx[i])) == 0)
+          useextents(inum, (struct extent*)block(xint(idx[i])), XPB);
+    }
+  } else {
+    for(i = 0; i < NDIRECT; i++)
+      if(dip->addrs[i])
+        use(inum, xint(dip->addrs[i]));
+    for(i = 0; i < 3; i++)
+      if(dip->addrs[NDIRECT+i])
+        useindirect(inum, xint(dip->addrs[NDIRECT+i]), i+1);
+  }
+
+  n = (xint(dip->size) + BSIZE-1) / BSIZE;
+  for(i = 0; i < n; i++){
+    if(bmap(dip, i) == 0){
+      problem("inode %u: block %u of %u is missing", inum, i, n);
+      break;
+    }
+  }
+}
+
+// Check the entries of directory inum and count the
+// references they make.
+void
+checkdir(uint inum, struct dinode *dip)
+{
+  uint size, bn, j, b, parent;
+  struct dirent *de;
+  struct dxhead *h;
+  struct dxentry *e;
+
+  size = xint(dip->size);
+  if(size % sizeof(struct dirent) != 0)
+    problem("directory %u: size %u is not a whole number of entries", inum, size);
+  parent = 0;
+  for(bn = 0; bn*BSIZE < size; bn++){
+    if((b = bmap(dip, bn)) == 0 || b >= sb.size)
+      return;
+    de = (struct dirent*)block(b);
+    for(j = 0; j < DPB && bn*BSIZE + j*sizeof(*de) < size; j++){
+      if(de[j].inum == 0)
+        continue;
+      if(xshort(de[j].inum) >= sb.ninodes ||
+         dinode(xshort(de[j].inum))->type == 0){
+        problem("directory %u: entry %.14s names free inode %u", inum,
+                de[j].name, xshort(de[j].inum));
+        continue;
+      }
+      if(strncmp(de[j].name, ".", DIRSIZ) == 0){
+        if(bn != 0 || j != 0 || xshort(de[j].inum) != inum)
+          problem("directory %u: bad \".\"", inum);
+        continue;  // "." does not count as a link
+      }
+      if(strncmp(de[j].name, "..", DIRSIZ) == 0){
+        if(bn != 0 || j != 1)
+          problem("directory %u: bad \"..\"", inum);
+        parent = xshort(de[j].inum);
+      }
+      refs[xshort(de[j].inum)]++;
+    }
+  }
+  if(parent == 0)
+    problem("directory %u: no \"..\"", inum);
+  else if(xshort(dinode(parent)->type) != T_DIR)
+    problem("directory %u: \"..\" is not a directory", inum);
+
+  // A hashed directory's index must name its leaves in order.
+  if(size < 3*BSIZE || (b = bmap(dip, 0)) == 0)
+    return;
+  h = (struct dxhead*)((struct dirent*)block(b) + 2);
+  if(h->inum != 0 || xshort(h->magic) != DXMAGIC)
+    return;
+  e = (struct dxentry*)(h + 1);
+  if(xint(h->nleaf) == 0 || xint(h->nleaf) > NDXENTRY || e[0].hash != 0){
+    problem("directory %u: bad index header", inum);
+    return;
+  }
+  for(j = 0; j < xint(h->nleaf); j++){
+    if(xint(e[j].block) == 0 || xint(e[j].block)*BSIZE >= size)
+      problem("directory %u: index entry %u names block %u", inum, j,
+              xint(e[j].block));
+    if(j > 0 && xint(e[j].hash) <= xint(e[j-1].hash))
+      problem("directory %u: index entry %u out of order", inum, j);
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  int fd;
+  struct stat st;
+  struct dinode *dip;
+  uint inum, b, g, nbitmap, free, leaked, marked;
+  short type;
+
+  if(argc != 2){
+    fprintf(stderr, "Usage: fsck fs.img\n");
+    exit(2);
+  }
+  if((fd = open(argv[1], O_RDONLY)) < 0 || fstat(fd, &st) < 0){
+    perror(argv[1]);
+    exit(2);
+  }
+  nimg = st.st_size / BSIZE;
+  img = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if(nimg < 2 || img == MAP_FAILED){
+    fprintf(stderr, "fsck: cannot map %s\n", argv[1]);
+    exit(2);
+  }
+
+  // Super block.
+  memmove(&sb, block(1), sizeof(sb));
+  sb.size = xint(sb.size);
+  sb.nblocks = xint(sb.nblocks);
+  sb.ninodes = xint(sb.ninodes);
+  sb.nlog = xint(sb.nlog);
+  sb.logstart = xint(sb.logstart);
+  sb.inodestart = xint(sb.inodestart);
+  sb.bmapstart = xint(sb.bmapstart);
+  sb.ngroups = xint(sb.ngroups);
+  nbitmap = sb.size/BPB + 1;
+  datastart = sb.bmapstart + nbitmap;
+  if(sb.size > nimg || sb.logstart != 2 ||
+     sb.inodestart != sb.logstart + sb.nlog ||
+     sb.bmapstart != sb.inodestart + sb.ninodes/IPB + 1 ||
+     datastart + sb.nblocks != sb.size ||
+     sb.ngroups == 0 || sb.ngroups > MAXGROUPS ||
+     sb.ngroups != (sb.size + BPG-1) / BPG){
+    fprintf(stderr, "fsck: %s: bad super block\n", argv[1]);
+    exit(2);
+  }
+
+  owner = calloc(sb.size, sizeof(*owner));
+  refs = calloc(sb.ninodes, sizeof(*refs));
+  if(owner == 0 || refs == 0){
+    perror("calloc");
+    exit(2);
+  }
+
+  // Inodes and their blocks.
+  for(inum = 1; inum < sb.ninodes; inum++){
+    dip = dinode(inum);
+    type = xshort(dip->type);
+    if(type == 0)
+      continue;
+    if(type != T_DIR && type != T_FILE && type != T_DEV && type != T_EXTENT){
+      problem("inode %u: bad type %d", inum, type);
+      continue;
+    }
+    if(type != T_DEV)
+      checkblocks(inum, dip);
+  }
+  if(xshort(dinode(ROOTINO)->type) != T_DIR){
+    fprintf(stderr, "fsck: %s: root is not a directory\n", argv[1]);
+    exit(1);
+  }
+
+  // Directories and link counts.
+  for(inum = 1; inum < sb.ninodes; inum++)
+    if(xshort(dinode(inum)->type) == T_DIR)
+      checkdir(inum, dinode(inum));
+  for(inum = 1; inum < sb.ninodes; inum++){
+    dip = dinode(inum);
+    if(dip->type == 0)
+      continue;
+    if(refs[inum] == 0)
+      problem("inode %u: allocated but in no directory", inum);
+    else if(xshort(dip->nlink) != refs[inum])
+      problem("inode %u: nlink %d, but %u directory entries", inum,
+              xshort(dip->nlink), refs[inum]);
+  }
+
+  // Bitmap and group counts.
+  leaked = 0;
+  for(g = 0; g < sb.ngroups; g++){
+    free = 0;
+    for(b = g*BPG; b < (g+1)*BPG && b < sb.size; b++){
+      marked = block(sb.bmapstart)[b/8] & (1 << (b%8));
+      if(!marked)
+        free++;
+      if(b < datastart){
+        if(!marked)
+          problem("metadata block %u is marked free", b);
+      } else if(owner[b] && !marked)
+        problem("block %u of inode %u is marked free", b, owner[b]);
+      else if(!owner[b] && marked)
+        leaked++;
+    }
+    if(xint(sb.gfree[g]) != free)
+      problem("group %u: super block says %u free, bitmap %u", g,
+              xint(sb.gfree[g]), free);
+  }
+  if(leaked)
+    problem("%u blocks are marked in use but belong to no inode", leaked);
+
+  printf("fsck: %s: %d problem%s\n", argv[1], errors, errors == 1 ? "" : "s");
+  exit(errors ? 1 : 0);
+}
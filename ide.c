@@ -26,10 +26,15 @@
 
 // idequeue points to the buf now being read/written to the disk.
 // idequeue->qnext points to the next buf to be processed.
+// A request covers idequeue and the bufs chained on its rnext,
+// which hold consecutive blocks; idecur is the one whose
+// sector idesect the disk transfers next.
 // You must hold idelock while manipulating queue.
 
 static struct spinlock idelock;
 static struct buf *idequeue;
+static struct buf *idecur;
+static int idesect;
 
 static int havedisk1;
 static void idestart(struct buf*);
@@ -69,33 +74,42 @@ ideinit(void)
   outb(0x1f6, 0xe0 | (0<<4));
 }
 
-// Start the request for b.  Caller must hold idelock.
+// Start the request for b and the bufs chained after it.
+// The disk moves one sector per interrupt, so a request may
+// span any number of blocks up to 256 sectors.
+// Caller must hold idelock.
 static void
 idestart(struct buf *b)
 {
+  struct buf *c;
+
   if(b == 0)
     panic("idestart");
-  if(b->blockno >= FSSIZE)
-    panic("incorrect blockno");
   int sector_per_block =  BSIZE/SECTOR_SIZE;
   int sector = b->blockno * sector_per_block;
-  int read_cmd = (sector_per_block == 1) ? IDE_CMD_READ :  IDE_CMD_RDMUL;
-  int write_cmd = (sector_per_block == 1) ? IDE_CMD_WRITE : IDE_CMD_WRMUL;
+  int nsect = 0;
+  for(c = b; c; c = c->rnext)
+    nsect += sector_per_block;
+  if(b->blockno + nsect/sector_per_block > FSSIZE)
+    panic("incorrect blockno");
 
-  if (sector_per_block > 7) panic("idestart");
+  if(nsect > 256)
+    panic("idestart: request too big");
 
+  idecur = b;
+  idesect = 0;
   idewait(0);
   outb(0x3f6, 0);  // generate interrupt
-  outb(0x1f2, sector_per_block);  // number of sectors
+  outb(0x1f2, nsect & 0xff);  // number of sectors, 0 means 256
   outb(0x1f3, sector & 0xff);
   outb(0x1f4, (sector >> 8) & 0xff);
   outb(0x1f5, (sector >> 16) & 0xff);
   outb(0x1f6, 0xe0 | ((b->dev&1)<<4) | ((sector>>24)&0x0f));
   if(b->flags & B_DIRTY){
-    outb(0x1f7, write_cmd);
-    outsl(0x1f0, b->data, BSIZE/4);
+    outb(0x1f7, IDE_CMD_WRITE);
+    outsl(0x1f0, b->data, SECTOR_SIZE/4);
   } else {
-    outb(0x1f7, read_cmd);
+    outb(0x1f7, IDE_CMD_READ);
   }
 }
 
@@ -112,16 +126,30 @@ ideintr(void)
     release(&idelock);
     return;
   }
-  idequeue = b->qnext;
 
   // Read data if needed.
   if(!(b->flags & B_DIRTY) && idewait(1) >= 0)
-    insl(0x1f0, b->data, BSIZE/4);
+    insl(0x1f0, idecur->data + idesect*SECTOR_SIZE, SECTOR_SIZE/4);
 
-  // Wake process waiting for this buf.
-  b->flags |= B_VALID;
-  b->flags &= ~B_DIRTY;
-  wakeup(b);
+  // Move on to the next sector, if the request has one.
+  if(++idesect == BSIZE/SECTOR_SIZE){
+    idecur = idecur->rnext;
+    idesect = 0;
+  }
+  if(idecur != 0){
+    if(b->flags & B_DIRTY)
+      outsl(0x1f0, idecur->data + idesect*SECTOR_SIZE, SECTOR_SIZE/4);
+    release(&idelock);
+    return;
+  }
+  idequeue = b->qnext;
+
+  // Wake processes waiting for the bufs of the request.
+  for(; b; b = b->rnext){
+    b->flags |= B_VALID;
+    b->flags &= ~B_DIRTY;
+    wakeup(b);
+  }
 
   // Start disk on next buf in queue.
   if(idequeue != 0)
@@ -134,15 +162,23 @@ ideintr(void)
 // Sync buf with disk.
 // If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
 // Else if B_VALID is not set, read buf from disk, set B_VALID.
+// Bufs chained on b->rnext, for the blocks following b's,
+// go to the disk in the same request.
 void
 iderw(struct buf *b)
 {
-  struct buf **pp;
-
-  if(!holdingsleep(&b->lock))
-    panic("iderw: buf not locked");
-  if((b->flags & (B_VALID|B_DIRTY)) == B_VALID)
-    panic("iderw: nothing to do");
+  struct buf **pp, *c;
+
+  for(c = b; c; c = c->rnext){
+    if(!holdingsleep(&c->lock))
+      panic("iderw: buf not locked");
+    if((c->flags & (B_VALID|B_DIRTY)) == B_VALID)
+      panic("iderw: nothing to do");
+    if(c->rnext && (c->rnext->dev != c->dev ||
+       c->rnext->blockno != c->blockno + 1 ||
+       (c->rnext->flags & B_DIRTY) != (c->flags & B_DIRTY)))
+      panic("iderw: bad chain");
+  }
   if(b->dev != 0 && !havedisk1)
     panic("iderw: ide disk 1 not present");
 
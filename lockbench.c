@@ -0,0 +1,56 @@
+// Sleep-lock handoff benchmark: time several stressfs instances
+// running at once, then several processes taking turns at one
+// file's inode lock with small positional reads and writes.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+
+#define NSTRESS 4
+#define NPROC 4
+#define ROUNDS 500
+
+int
+main(int argc, char *argv[])
+{
+  int i, j, fd, t0;
+  char buf[64];
+  char *args[] = { "stressfs", 0 };
+
+  t0 = vuptime();
+  for(i = 0; i < NSTRESS; i++){
+    if(fork() == 0){
+      close(1);  // keep stressfs quiet
+      exec("stressfs", args);
+      exit();
+    }
+  }
+  for(i = 0; i < NSTRESS; i++)
+    wait();
+  printf(1, "lockbench: %d stressfs at once: %d ticks\n", NSTRESS, vuptime() - t0);
+
+  if((fd = open("lbfile", O_CREATE|O_RDWR)) < 0){
+    printf(1, "lockbench: create lbfile failed\n");
+    exit();
+  }
+  memset(buf, 'l', sizeof(buf));
+  write(fd, buf, sizeof(buf));
+  t0 = vuptime();
+  for(i = 0; i < NPROC; i++){
+    if(fork() == 0){
+      for(j = 0; j < ROUNDS; j++){
+        pread(fd, buf, sizeof(buf), 0);
+        pwrite(fd, buf, sizeof(buf), 0);
+      }
+      exit();
+    }
+  }
+  for(i = 0; i < NPROC; i++)
+    wait();
+  printf(1, "lockbench: %d processes, %d reads and writes each on one file: %d ticks\n",
+         NPROC, ROUNDS, vuptime() - t0);
+  close(fd);
+  unlink("lbfile");
+  exit();
+}
@@ -20,9 +20,35 @@
 // But if it thinks the log is close to running out, it
 // sleeps until the last outstanding end_op() commits.
 //
+// Commits are pipelined with the next transaction. commit()
+// first snapshots the transaction's blocks out of the buffer
+// cache; only during that copy must begin_op() wait. While the
+// snapshot is written to the log, new system calls join the
+// next transaction, and system calls that end in the meantime
+// are grouped into the next commit. end_op() does not return
+// until the transaction holding the caller's writes is durable,
+// so system calls keep their synchronous semantics.
+//
+// With WRITEBACK, file data bypasses the log (see writei) and
+// end_op() neither waits for nor forces a commit unless the
+// transaction has grown to LOGBATCH blocks. A flusher thread
+// writes data back and commits every FLUSHTICKS ticks, and
+// fsync()/sync() call log_force() to make changes durable.
+// Metadata updates stay atomic, but may be lost in a crash.
+// commit() writes delayed data back before the commit record,
+// so committed metadata never points at stale blocks.
+//
+// Installing committed blocks to their home locations is
+// deferred. Committed transactions accumulate in the log, which
+// is used as a ring, and a checkpoint thread installs them in
+// the background once the log is half full or begin_op() runs
+// short of space. Until then the blocks stay pinned in the
+// buffer cache, which always holds their latest contents.
+//
 // The log is a physical re-do log containing disk blocks.
 // The on-disk log format:
-//   header block, containing block #s for block A, B, C, ...
+//   header block, containing the ring slot of block A
+//     and block #s for block A, B, C, ...
 //   block A
 //   block B
 //   block C
@@ -33,6 +59,7 @@
 // and to keep track in memory of logged block# before commit.
 struct logheader {
   int n;
+  int tail;
   int block[LOGSIZE];
 };
 
@@ -41,43 +68,128 @@ struct log {
   int start;
   int size;
   int outstanding; // how many FS sys calls are executing.
-  int committing;  // in commit(), please wait.
+  int committing;  // in commit() or checkpoint(), please wait.
+  int copying;     // commit() is copying blocks, please wait to begin.
+  int ncommit;     // blocks commit() is appending after clh
   int dev;
-  struct logheader lh;
+  uint seq;        // sequence number of the open transaction
+  uint done;       // last transaction that is durable on disk
+  uint waited;     // last transaction that sat out LOGWINDOW
+  struct logheader lh;      // open transaction
+  struct logheader clh;     // committed but not yet installed
+  struct buf copy[LOGSIZE]; // contents of each ring slot
 };
 struct log log;
 
 static void recover_from_log(void);
 static void commit();
+static void checkpointer(void);
+static void flusher(void);
+static void write_head(int);
+
+// Ring slot of the ith committed block.
+#define SLOT(i) ((log.clh.tail + (i)) % (log.size - 1))
 
 void
 initlog(int dev)
 {
+  int i;
+
   if (sizeof(struct logheader) >= BSIZE)
     panic("initlog: too big logheader");
 
   struct superblock sb;
   initlock(&log.lock, "log");
+  for (i = 0; i < LOGSIZE; i++)
+    initsleeplock(&log.copy[i].lock, "logcopy");
   readsb(dev, &sb);
   log.start = sb.logstart;
   log.size = sb.nlog;
   log.dev = dev;
+  log.seq = 1;
+  if (log.size - 1 > LOGSIZE)
+    panic("initlog: log too big");
   recover_from_log();
+  if (kproc("checkpoint", checkpointer) < 0)
+    panic("initlog: checkpoint thread");
+  if (WRITEBACK && kproc("flush", flusher) < 0)
+    panic("initlog: flush thread");
 }
 
-// Copy committed blocks from log to their home location
+// Write a snapshot buffer to disk block blockno.
 static void
-install_trans(void)
+copy_write(struct buf *b, uint blockno)
 {
-  int tail;
+  acquiresleep(&b->lock);
+  b->dev = log.dev;
+  b->blockno = blockno;
+  b->flags = B_VALID|B_DIRTY;
+  iderw(b);
+  releasesleep(&b->lock);
+}
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
-    brelse(lbuf);
-    brelse(dbuf);
+// Is the log too full for one more op to begin?
+static int
+log_full(void)
+{
+  return log.clh.n + log.ncommit + log.lh.n +
+    (log.outstanding+1)*MAXOPBLOCKS > log.size - 1;
+}
+
+// Copy committed blocks from their snapshots to their home
+// locations, then release the log space they occupied.
+static void
+checkpoint(void)
+{
+  int i, m;
+
+  acquire(&log.lock);
+  m = log.clh.n;
+  release(&log.lock);
+
+  // Only the checkpoint thread removes entries from clh,
+  // so the first m entries stay put while we install them.
+  for (i = 0; i < m; i++)
+    copy_write(&log.copy[SLOT(i)], log.clh.block[i]);
+
+  acquire(&log.lock);
+  while(log.committing)
+    sleep(&log, &log.lock);
+  log.committing = 1;
+  release(&log.lock);
+
+  for (i = 0; i < m; i++) {
+    // Let the buffer cache evict the installed block.
+    struct buf *b = bread(log.dev, log.clh.block[i]);
+    bunpin(b);
+    brelse(b);
+  }
+
+  acquire(&log.lock);
+  log.clh.n -= m;
+  memmove(log.clh.block, log.clh.block+m, log.clh.n*sizeof(int));
+  log.clh.tail = (log.clh.tail + m) % (log.size - 1);
+  release(&log.lock);
+
+  write_head(log.clh.n);  // Erase the installed blocks from the log
+
+  acquire(&log.lock);
+  log.committing = 0;
+  wakeup(&log);
+  release(&log.lock);
+}
+
+// Kernel thread that checkpoints the log in the background.
+static void
+checkpointer(void)
+{
+  for(;;){
+    acquire(&log.lock);
+    while(log.clh.n == 0 ||
+          (log.clh.n < (log.size - 1)/2 && !log_full()))
+      sleep(&log.clh, &log.lock);
+    release(&log.lock);
+    checkpoint();
   }
 }
 
@@ -88,25 +200,27 @@ read_head(void)
   struct buf *buf = bread(log.dev, log.start);
   struct logheader *lh = (struct logheader *) (buf->data);
   int i;
-  log.lh.n = lh->n;
-  for (i = 0; i < log.lh.n; i++) {
-    log.lh.block[i] = lh->block[i];
+  log.clh.n = lh->n;
+  log.clh.tail = lh->tail;
+  for (i = 0; i < log.clh.n; i++) {
+    log.clh.block[i] = lh->block[i];
   }
   brelse(buf);
 }
 
-// Write in-memory log header to disk.
-// This is the true point at which the
-// current transaction commits.
+// Write the first n committed entries of the in-memory
+// log header to disk. This is the true point at which
+// the current transaction commits.
 static void
-write_head(void)
+write_head(int n)
 {
   struct buf *buf = bread(log.dev, log.start);
   struct logheader *hb = (struct logheader *) (buf->data);
   int i;
-  hb->n = log.lh.n;
-  for (i = 0; i < log.lh.n; i++) {
-    hb->block[i] = log.lh.block[i];
+  hb->n = n;
+  hb->tail = log.clh.tail;
+  for (i = 0; i < n; i++) {
+    hb->block[i] = log.clh.block[i];
   }
   bwrite(buf);
   brelse(buf);
@@ -115,10 +229,21 @@ write_head(void)
 static void
 recover_from_log(void)
 {
+  int tail;
+
   read_head();
-  install_trans(); // if committed, copy from log to disk
-  log.lh.n = 0;
-  write_head(); // clear the log
+  // if committed, copy from log to disk
+  for (tail = 0; tail < log.clh.n; tail++) {
+    struct buf *lbuf = bread(log.dev, log.start+SLOT(tail)+1); // read log block
+    struct buf *dbuf = bread(log.dev, log.clh.block[tail]); // read dst
+    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
+    bwrite(dbuf);  // write dst to disk
+    brelse(lbuf);
+    brelse(dbuf);
+  }
+  log.clh.n = 0;
+  log.clh.tail = 0;
+  write_head(0); // clear the log
 }
 
 // called at the start of each FS system call.
@@ -127,10 +252,16 @@ begin_op(void)
 {
   acquire(&log.lock);
   while(1){
-    if(log.committing){
+    if(log.copying){
       sleep(&log, &log.lock);
-    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
-      // this op might exhaust log space; wait for commit.
+    } else if(log_full()){
+      // this op might exhaust log space;
+      // wait for commit and checkpoint.
+      if(log.outstanding == 0 && !log.committing && log.lh.n > 0){
+        commit();
+        continue;
+      }
+      wakeup(&log.clh);
       sleep(&log, &log.lock);
     } else {
       log.outstanding += 1;
@@ -141,69 +272,159 @@ begin_op(void)
 }
 
 // called at the end of each FS system call.
-// commits if this was the last outstanding operation.
+// commits if this was the last outstanding operation,
+// then waits until the operation's transaction is on disk.
 void
 end_op(void)
 {
-  int do_commit = 0;
+  uint seq, t0;
 
   acquire(&log.lock);
+  seq = log.seq;
   log.outstanding -= 1;
-  if(log.committing)
-    panic("log.committing");
-  if(log.outstanding == 0){
-    do_commit = 1;
-    log.committing = 1;
-  } else {
-    // begin_op() may be waiting for log space,
-    // and decrementing log.outstanding has decreased
-    // the amount of reserved space.
-    wakeup(&log);
+  // begin_op() may be waiting for log space,
+  // and decrementing log.outstanding has decreased
+  // the amount of reserved space.
+  wakeup(&log);
+
+  while(log.seq == seq && log.lh.n > 0){
+    if(WRITEBACK && (log.outstanding > 0 || log.committing ||
+                     log.lh.n < LOGBATCH)){
+      // leave the commit to a later op, the flusher or fsync.
+      break;
+    } else if(log.outstanding > 0 || log.committing){
+      // the last op, or whoever finishes the commit
+      // in flight, will commit this transaction.
+      sleep(&log, &log.lock);
+    } else if(LOGWINDOW > 0 && log.waited != seq && log.lh.n < LOGBATCH){
+      // small transaction: give other ops a chance to join.
+      log.waited = seq;
+      release(&log.lock);
+      acquire(&tickslock);
+      t0 = ticks;
+      while(ticks - t0 < LOGWINDOW)
+        sleep(&ticks, &tickslock);
+      release(&tickslock);
+      acquire(&log.lock);
+    } else {
+      commit();
+    }
   }
+
+  // An op that ran in an empty transaction wrote nothing
+  // and need not wait for anybody else's commit.
+  while(!WRITEBACK && log.seq != seq && (int)(log.done - seq) < 0)
+    sleep(&log, &log.lock);
   release(&log.lock);
+}
 
-  if(do_commit){
-    // call commit w/o holding locks, since not allowed
-    // to sleep with locks.
-    commit();
-    acquire(&log.lock);
-    log.committing = 0;
-    wakeup(&log);
-    release(&log.lock);
+// Commit the open transaction and wait until it, and every
+// transaction before it, is on disk. Must not be called
+// inside a transaction.
+void
+log_force(void)
+{
+  uint seq;
+
+  acquire(&log.lock);
+  seq = log.seq;
+  while(log.seq == seq && log.lh.n > 0){
+    if(log.outstanding > 0 || log.committing)
+      sleep(&log, &log.lock);
+    else
+      commit();
   }
+  while(log.seq != seq && (int)(log.done - seq) < 0)
+    sleep(&log, &log.lock);
+  release(&log.lock);
 }
 
-// Copy modified blocks from cache to log.
+// Kernel thread that periodically writes back delayed
+// file data and then commits the metadata that refers to it.
 static void
-write_log(void)
+flusher(void)
+{
+  uint t0;
+
+  for(;;){
+    acquire(&tickslock);
+    t0 = ticks;
+    while(ticks - t0 < FLUSHTICKS)
+      sleep(&ticks, &tickslock);
+    release(&tickslock);
+    bflush(log.dev, 0);
+    log_force();
+  }
+}
+
+// Snapshot the blocks being committed out of the cache.
+static void
+copy_log(void)
 {
   int tail;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
-    struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
+  for (tail = log.clh.n; tail < log.clh.n + log.ncommit; tail++) {
+    struct buf *from = bread(log.dev, log.clh.block[tail]); // cache block
+    memmove(log.copy[SLOT(tail)].data, from->data, BSIZE);
     brelse(from);
-    brelse(to);
   }
 }
 
+// Append the snapshot to the log.
+static void
+write_log(void)
+{
+  int tail;
+
+  for (tail = log.clh.n; tail < log.clh.n + log.ncommit; tail++)
+    copy_write(&log.copy[SLOT(tail)], log.start+SLOT(tail)+1);
+}
+
+// Commit the open transaction by appending it to the
+// committed blocks that wait for checkpoint.
+// Called and returns with log.lock held, but drops it
+// while talking to the disk.
 static void
 commit()
 {
-  if (log.lh.n > 0) {
-    write_log();     // Write modified blocks from cache to log
-    write_head();    // Write header to disk -- the real commit
-    install_trans(); // Now install writes to home locations
-    log.lh.n = 0;
-    write_head();    // Erase the transaction from the log
-  }
+  uint seq;
+  int i;
+
+  log.committing = 1;
+  log.copying = 1;
+  seq = log.seq++;
+  for (i = 0; i < log.lh.n; i++)
+    log.clh.block[log.clh.n+i] = log.lh.block[i];
+  log.ncommit = log.lh.n;
+  log.lh.n = 0;
+  release(&log.lock);
+
+  copy_log();      // Snapshot modified blocks
+
+  acquire(&log.lock);
+  log.copying = 0;
+  wakeup(&log);    // the next transaction may start
+  release(&log.lock);
+
+  write_log();     // Write snapshot to log
+  if(WRITEBACK)
+    bflush(log.dev, 0);  // data before the metadata that refers to it
+  write_head(log.clh.n + log.ncommit);  // the real commit
+
+  acquire(&log.lock);
+  log.clh.n += log.ncommit;
+  log.ncommit = 0;
+  log.done = seq;
+  log.committing = 0;
+  wakeup(&log);    // ops of this transaction may return
+  if (log.clh.n >= (log.size - 1)/2)
+    wakeup(&log.clh);
 }
 
 // Caller has modified b->data and is done with the buffer.
-// Record the block number and pin in the cache with B_DIRTY.
-// commit()/write_log() will do the disk write.
+// Record the block number and pin it in the cache.
+// commit()/write_log() will do the disk write, and
+// checkpoint() will unpin it once it is installed.
 //
 // log_write() replaces bwrite(); a typical use is:
 //   bp = bread(...)
@@ -226,9 +447,10 @@ log_write(struct buf *b)
       break;
   }
   log.lh.block[i] = b->blockno;
-  if (i == log.lh.n)
+  if (i == log.lh.n) {  // Add new block to log?
+    bpin(b);            // prevent eviction
     log.lh.n++;
-  b->flags |= B_DIRTY; // prevent eviction
+  }
+  b->flags &= ~B_DELAY; // the log writes it now
   release(&log.lock);
 }
-
@@ -3,6 +3,10 @@
 #include "user.h"
 #include "fs.h"
 
+#define NDS 64  // entries per getdents
+
+struct dirstat ds[NDS];
+
 char*
 fmtname(char *path)
 {
@@ -25,9 +29,7 @@ fmtname(char *path)
 void
 ls(char *path)
 {
-  char buf[512], *p;
-  int fd;
-  struct dirent de;
+  int fd, i, n;
   struct stat st;
 
   if((fd = open(path, 0)) < 0){
@@ -43,28 +45,18 @@ ls(char *path)
 
   switch(st.type){
   case T_FILE:
+  case T_EXTENT:
     printf(1, "%s %d %d %d\n", fmtname(path), st.type, st.ino, st.size);
     break;
 
   case T_DIR:
-    if(strlen(path) + 1 + DIRSIZ + 1 > sizeof buf){
-      printf(1, "ls: path too long\n");
-      break;
-    }
-    strcpy(buf, path);
-    p = buf+strlen(buf);
-    *p++ = '/';
-    while(read(fd, &de, sizeof(de)) == sizeof(de)){
-      if(de.inum == 0)
-        continue;
-      memmove(p, de.name, DIRSIZ);
-      p[DIRSIZ] = 0;
-      if(stat(buf, &st) < 0){
-        printf(1, "ls: cannot stat %s\n", buf);
-        continue;
-      }
-      printf(1, "%s %d %d %d\n", fmtname(buf), st.type, st.ino, st.size);
+    while((n = getdents(fd, ds, NDS)) > 0){
+      for(i = 0; i < n; i++)
+        printf(1, "%s %d %d %d\n", fmtname(ds[i].name),
+               ds[i].st.type, ds[i].st.ino, ds[i].st.size);
     }
+    if(n < 0)
+      printf(2, "ls: cannot read %s\n", path);
     break;
   }
   close(fd);
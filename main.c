@@ -27,9 +27,13 @@ main(void)
   consoleinit();   // console hardware
   uartinit();      // serial port
   pinit();         // process table
+  rcuinit();       // read-copy update
+  vdsoinit();      // page of kernel data for user programs
   tvinit();        // trap vectors
   binit();         // buffer cache
+  dcinit();        // directory entry cache
   fileinit();      // file table
+  ringinit();      // asynchronous I/O rings
   ideinit();       // disk 
   startothers();   // start other processors
   kinit2(P2V(4*1024*1024), P2V(PHYSTOP)); // must come after startothers()
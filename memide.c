@@ -35,26 +35,29 @@ ideintr(void)
 // Sync buf with disk.
 // If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
 // Else if B_VALID is not set, read buf from disk, set B_VALID.
+// Does the same for the bufs chained on b->rnext.
 void
 iderw(struct buf *b)
 {
   uchar *p;
 
-  if(!holdingsleep(&b->lock))
-    panic("iderw: buf not locked");
-  if((b->flags & (B_VALID|B_DIRTY)) == B_VALID)
-    panic("iderw: nothing to do");
-  if(b->dev != 1)
-    panic("iderw: request not for disk 1");
-  if(b->blockno >= disksize)
-    panic("iderw: block out of range");
-
-  p = memdisk + b->blockno*BSIZE;
-
-  if(b->flags & B_DIRTY){
-    b->flags &= ~B_DIRTY;
-    memmove(p, b->data, BSIZE);
-  } else
-    memmove(b->data, p, BSIZE);
-  b->flags |= B_VALID;
+  for(; b; b = b->rnext){
+    if(!holdingsleep(&b->lock))
+      panic("iderw: buf not locked");
+    if((b->flags & (B_VALID|B_DIRTY)) == B_VALID)
+      panic("iderw: nothing to do");
+    if(b->dev != 1)
+      panic("iderw: request not for disk 1");
+    if(b->blockno >= disksize)
+      panic("iderw: block out of range");
+
+    p = memdisk + b->blockno*BSIZE;
+
+    if(b->flags & B_DIRTY){
+      b->flags &= ~B_DIRTY;
+      memmove(p, b->data, BSIZE);
+    } else
+      memmove(b->data, p, BSIZE);
+    b->flags |= B_VALID;
+  }
 }
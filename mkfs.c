@@ -4,18 +4,21 @@
 #include <string.h>
 #include <fcntl.h>
 #include <assert.h>
+#include <sys/mman.h>
 
 #define stat xv6_stat  // avoid clash with host struct stat
 #include "types.h"
 #include "fs.h"
 #include "stat.h"
+#undef MAP_ANONYMOUS  // xv6's mmap flags, from param.h
+#undef MAP_POPULATE
 #include "param.h"
 
 #ifndef static_assert
 #define static_assert(a, b) do { switch (0) case 0: case (a): ; } while (0)
 #endif
 
-#define NINODES 200
+#define NINODES 11000
 
 // Disk layout:
 // [ boot block | sb block | log | inode blocks | free bit map | data blocks ]
@@ -23,12 +26,13 @@
 int nbitmap = FSSIZE/(BSIZE*8) + 1;
 int ninodeblocks = NINODES / IPB + 1;
 int nlog = LOGSIZE;
+int ngroups = (FSSIZE + BPG - 1) / BPG;
 int nmeta;    // Number of meta blocks (boot, sb, nlog, inode, bitmap)
 int nblocks;  // Number of data blocks
 
 int fsfd;
+char *img;    // the image, mapped into memory
 struct superblock sb;
-char zeroes[BSIZE];
 uint freeinode = 1;
 uint freeblock;
 
@@ -83,14 +87,26 @@ main(int argc, char *argv[])
 
   assert((BSIZE % sizeof(struct dinode)) == 0);
   assert((BSIZE % sizeof(struct dirent)) == 0);
+  assert((BPB % BPG) == 0);
+  assert(ngroups <= MAXGROUPS);
 
   fsfd = open(argv[1], O_RDWR|O_CREAT|O_TRUNC, 0666);
   if(fsfd < 0){
     perror(argv[1]);
     exit(1);
   }
+  // The image starts out all zeroes.
+  if(ftruncate(fsfd, (off_t)FSSIZE*BSIZE) < 0){
+    perror("ftruncate");
+    exit(1);
+  }
+  img = mmap(0, (size_t)FSSIZE*BSIZE, PROT_READ|PROT_WRITE, MAP_SHARED, fsfd, 0);
+  if(img == MAP_FAILED){
+    perror("mmap");
+    exit(1);
+  }
 
-  // 1 fs block = 1 disk sector
+  // 1 fs block = BSIZE/512 disk sectors
   nmeta = 2 + nlog + ninodeblocks + nbitmap;
   nblocks = FSSIZE - nmeta;
 
@@ -101,15 +117,13 @@ main(int argc, char *argv[])
   sb.logstart = xint(2);
   sb.inodestart = xint(2+nlog);
   sb.bmapstart = xint(2+nlog+ninodeblocks);
+  sb.ngroups = xint(ngroups);
 
   printf("nmeta %d (boot, super, log blocks %u inode blocks %u, bitmap blocks %u) blocks %d total %d\n",
          nmeta, nlog, ninodeblocks, nbitmap, nblocks, FSSIZE);
 
   freeblock = nmeta;     // the first free block that we can allocate
 
-  for(i = 0; i < FSSIZE; i++)
-    wsect(i, zeroes);
-
   memset(buf, 0, sizeof(buf));
   memmove(buf, &sb, sizeof(sb));
   wsect(1, buf);
@@ -164,20 +178,18 @@ main(int argc, char *argv[])
 
   balloc(freeblock);
 
+  if(munmap(img, (size_t)FSSIZE*BSIZE) < 0 || close(fsfd) < 0){
+    perror(argv[1]);
+    exit(1);
+  }
   exit(0);
 }
 
 void
 wsect(uint sec, void *buf)
 {
-  if(lseek(fsfd, sec * BSIZE, 0) != sec * BSIZE){
-    perror("lseek");
-    exit(1);
-  }
-  if(write(fsfd, buf, BSIZE) != BSIZE){
-    perror("write");
-    exit(1);
-  }
+  assert(sec < FSSIZE);
+  memmove(img + (size_t)sec*BSIZE, buf, BSIZE);
 }
 
 void
@@ -210,14 +222,8 @@ rinode(uint inum, struct dinode *ip)
 void
 rsect(uint sec, void *buf)
 {
-  if(lseek(fsfd, sec * BSIZE, 0) != sec * BSIZE){
-    perror("lseek");
-    exit(1);
-  }
-  if(read(fsfd, buf, BSIZE) != BSIZE){
-    perror("read");
-    exit(1);
-  }
+  assert(sec < FSSIZE);
+  memmove(buf, img + (size_t)sec*BSIZE, BSIZE);
 }
 
 uint
@@ -234,24 +240,34 @@ ialloc(ushort type)
   return inum;
 }
 
+#define min(a, b) ((a) < (b) ? (a) : (b))
+
 void
 balloc(int used)
 {
-  uchar buf[BSIZE];
-  int i;
+  uchar buf[BSIZE], *bitmap;
+  int i, g, n;
 
   printf("balloc: first %d blocks have been allocated\n", used);
-  assert(used < BSIZE*8);
-  bzero(buf, BSIZE);
-  for(i = 0; i < used; i++){
-    buf[i/8] = buf[i/8] | (0x1 << (i%8));
+  assert(used < nbitmap*BSIZE*8);
+  // The bitmap blocks are consecutive, and so form one bitmap.
+  bitmap = (uchar*)img + (size_t)sb.bmapstart*BSIZE;
+  memset(bitmap, 0xff, used/8);
+  for(i = used/8*8; i < used; i++)
+    bitmap[i/8] |= 0x1 << (i%8);
+
+  // Count the free blocks of each group into the super block.
+  for(g = 0; g < ngroups; g++){
+    n = min((g+1)*BPG, FSSIZE) - g*BPG;
+    if(used > g*BPG)
+      n -= min(used, (g+1)*BPG) - g*BPG;
+    sb.gfree[g] = xint(n);
   }
-  printf("balloc: write bitmap block at sector %d\n", sb.bmapstart);
-  wsect(sb.bmapstart, buf);
+  bzero(buf, BSIZE);
+  memmove(buf, &sb, sizeof(sb));
+  wsect(1, buf);
 }
 
-#define min(a, b) ((a) < (b) ? (a) : (b))
-
 void
 iappend(uint inum, void *xp, int n)
 {
@@ -260,7 +276,8 @@ iappend(uint inum, void *xp, int n)
   struct dinode din;
   char buf[BSIZE];
   uint indirect[NINDIRECT];
-  uint x;
+  uint x, bn, span;
+  int level;
 
   rinode(inum, &din);
   off = xint(din.size);
@@ -274,15 +291,27 @@ iappend(uint inum, void *xp, int n)
       }
       x = xint(din.addrs[fbn]);
     } else {
-      if(xint(din.addrs[NDIRECT]) == 0){
-        din.addrs[NDIRECT] = xint(freeblock++);
+      // Same walk as bmap() in fs.c.
+      bn = fbn - NDIRECT;
+      span = NINDIRECT;
+      for(level = 1; bn >= span; level++){
+        bn -= span;
+        span *= NINDIRECT;
+      }
+      if(xint(din.addrs[NDIRECT+level-1]) == 0){
+        din.addrs[NDIRECT+level-1] = xint(freeblock++);
       }
-      rsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      if(indirect[fbn - NDIRECT] == 0){
-        indirect[fbn - NDIRECT] = xint(freeblock++);
-        wsect(xint(din.addrs[NDIRECT]), (char*)indirect);
+      x = xint(din.addrs[NDIRECT+level-1]);
+      while(level-- > 0){
+        span /= NINDIRECT;
+        rsect(x, (char*)indirect);
+        if(indirect[bn / span] == 0){
+          indirect[bn / span] = xint(freeblock++);
+          wsect(x, (char*)indirect);
+        }
+        x = xint(indirect[bn / span]);
+        bn %= span;
       }
-      x = xint(indirect[fbn-NDIRECT]);
     }
     n1 = min(n, (fbn + 1) * BSIZE - off);
     rsect(x, buf);
@@ -1,16 +1,35 @@
-#define NPROC        64  // maximum number of processes
+#define NPROC      4096  // maximum number of processes
 #define KSTACKSIZE 4096  // size of per-process kernel stack
 #define NCPU          8  // maximum number of CPUs
-#define NOFILE       16  // open files per process
+#define NPIDHASH     64  // hash buckets for finding a process by pid
+#define NOFILE       16  // open files per process before its table grows
+#define NOFILEMAX   992  // open files per process; one page with the bitmap
+#define NMMAP        64  // mmap areas per process
 #define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define PIPEPAGES     4  // pages in a new pipe's buffer
+#define PIPEMAXPAGES 64  // pages fcntl may give a pipe; a power of two
+#define NINODE       50  // minimum number of cached i-nodes
+#define NIHASH       61  // hash buckets in i-node cache
+#define NDENTRY     128  // size of directory entry cache
+#define NDHASH       61  // hash buckets in directory entry cache
 #define NDEV         10  // maximum major device number
+#define NLOCKSTAT    64  // lock names lockdump() tells apart
+#define SLEEPSPIN 20000  // cycles acquiresleep spins on a running holder
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
+#define MAXPATH     128  // longest path a ring open takes
+#define NRINGWORKER   4  // kernel threads serving I/O rings
+#define NRINGREQ    128  // ring requests in flight, all processes
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       1000  // size of file system in blocks
+#define LOGSIZE      (MAXOPBLOCKS*12)  // max data blocks in on-disk log
+#define LOGBATCH     (MAXOPBLOCKS*2)  // transactions this big commit at once
+#define LOGWINDOW    0  // ticks a smaller transaction waits for company
+#define WRITEBACK    0  // write file data back lazily; see fsync()
+#define FLUSHTICKS   100  // ticks between background write-backs
+#define RESWIN       16  // blocks reserved ahead of a growing file
+#define NRUN         16  // max blocks in one disk request
+#define NBUF         (LOGSIZE*2+MAXOPBLOCKS*4)  // size of disk block cache
+#define FSSIZE       4000  // size of file system in blocks
 #define PROT_READ 0x1
 #define PROT_WRITE 0x2
 #define MAP_ANONYMOUS 0x1
@@ -8,21 +8,46 @@
 #include "sleeplock.h"
 #include "file.h"
 
-#define PIPESIZE 512
+// A pipe's buffer is a ring of size bytes, a power of two,
+// kept in size/PGSIZE pages that need not be contiguous.
+// Data moves in spans that stop at page boundaries.
+//
+// wakeup() looks at every process, so the two sides only wake
+// each other when someone is asleep and, for a writer waiting
+// for room, once there is as much room as it asked for: half
+// the buffer, or what is left to write if less.
 
 struct pipe {
   struct spinlock lock;
-  char data[PIPESIZE];
+  char *page[PIPEMAXPAGES];
+  uint size;      // bytes in the ring
   uint nread;     // number of bytes read
   uint nwrite;    // number of bytes written
   int readopen;   // read fd is still open
   int writeopen;  // write fd is still open
+  int nrsleep;    // readers waiting for data
+  int nwsleep;    // writers waiting for room
+  uint wneed;     // room the waiting writers want
 };
 
+static int pipecls;  // lock class of pipes; 0 until looked up
+
+static void
+pipefree(struct pipe *p)
+{
+  int i;
+
+  for(i = 0; i < PIPEMAXPAGES; i++)
+    if(p->page[i])
+      kfree(p->page[i]);
+  kfree((char*)p);
+}
+
 int
 pipealloc(struct file **f0, struct file **f1)
 {
   struct pipe *p;
+  int i;
 
   p = 0;
   *f0 = *f1 = 0;
@@ -30,11 +55,16 @@ pipealloc(struct file **f0, struct file **f1)
     goto bad;
   if((p = (struct pipe*)kalloc()) == 0)
     goto bad;
+  memset(p, 0, sizeof(*p));
+  for(i = 0; i < PIPEPAGES; i++)
+    if((p->page[i] = kalloc()) == 0)
+      goto bad;
+  p->size = PIPEPAGES*PGSIZE;
   p->readopen = 1;
   p->writeopen = 1;
-  p->nwrite = 0;
-  p->nread = 0;
-  initlock(&p->lock, "pipe");
+  if(pipecls == 0)
+    pipecls = lockclass("pipe");
+  initlockcls(&p->lock, "pipe", pipecls);
   (*f0)->type = FD_PIPE;
   (*f0)->readable = 1;
   (*f0)->writable = 0;
@@ -48,7 +78,7 @@ pipealloc(struct file **f0, struct file **f1)
 //PAGEBREAK: 20
  bad:
   if(p)
-    kfree((char*)p);
+    pipefree(p);
   if(*f0)
     fileclose(*f0);
   if(*f1)
@@ -69,38 +99,146 @@ pipeclose(struct pipe *p, int writable)
   }
   if(p->readopen == 0 && p->writeopen == 0){
     release(&p->lock);
-    kfree((char*)p);
+    pipefree(p);
   } else
     release(&p->lock);
 }
 
+// Copy n bytes from addr into p, which has room for them.
+static void
+put(struct pipe *p, char *addr, uint n)
+{
+  uint o, m;
+
+  while(n > 0){
+    o = p->nwrite & (p->size - 1);
+    m = PGSIZE - o%PGSIZE;
+    if(m > n)
+      m = n;
+    memmove(p->page[o/PGSIZE] + o%PGSIZE, addr, m);
+    p->nwrite += m;
+    addr += m;
+    n -= m;
+  }
+}
+
+// Copy n bytes, which p holds, out of p to addr.
+static void
+take(struct pipe *p, char *addr, uint n)
+{
+  uint o, m;
+
+  while(n > 0){
+    o = p->nread & (p->size - 1);
+    m = PGSIZE - o%PGSIZE;
+    if(m > n)
+      m = n;
+    memmove(addr, p->page[o/PGSIZE] + o%PGSIZE, m);
+    p->nread += m;
+    addr += m;
+    n -= m;
+  }
+}
+
+static void
+wakereaders(struct pipe *p)
+{
+  if(p->nrsleep)
+    wakeup(&p->nread);
+}
+
+static void
+wakewriters(struct pipe *p)
+{
+  if(p->nwsleep && p->size - (p->nwrite - p->nread) >= p->wneed)
+    wakeup(&p->nwrite);
+}
+
+// Sleep until p has room for want bytes, or half of it
+// if that is less. Return -1 if nobody will read p.
+// Caller holds p->lock.
+static int
+waitroom(struct pipe *p, uint want)
+{
+  while(p->nwrite == p->nread + p->size){  //DOC: pipewrite-full
+    if(p->readopen == 0 || myproc()->killed)
+      return -1;
+    wakereaders(p);
+    if(want > p->size/2)
+      want = p->size/2;
+    if(p->nwsleep++ == 0 || want < p->wneed)
+      p->wneed = want;
+    sleep(&p->nwrite, &p->lock);  //DOC: pipewrite-sleep
+    p->nwsleep--;
+  }
+  return 0;
+}
+
 //PAGEBREAK: 40
 int
 pipewrite(struct pipe *p, char *addr, int n)
 {
   int i;
+  uint m;
 
   acquire(&p->lock);
-  for(i = 0; i < n; i++){
-    while(p->nwrite == p->nread + PIPESIZE){  //DOC: pipewrite-full
-      if(p->readopen == 0 || myproc()->killed){
-        release(&p->lock);
-        return -1;
-      }
-      wakeup(&p->nread);
-      sleep(&p->nwrite, &p->lock);  //DOC: pipewrite-sleep
+  for(i = 0; i < n; i += m){
+    if(waitroom(p, n - i) < 0){
+      release(&p->lock);
+      return -1;
     }
-    p->data[p->nwrite++ % PIPESIZE] = addr[i];
+    m = p->size - (p->nwrite - p->nread);
+    if(m > n - i)
+      m = n - i;
+    put(p, addr + i, m);
   }
-  wakeup(&p->nread);  //DOC: pipewrite-wakeup1
+  wakereaders(p);  //DOC: pipewrite-wakeup1
   release(&p->lock);
   return n;
 }
 
+// Wait until p has room and return how much,
+// or -1 if nobody will read it.
+int
+pipespace(struct pipe *p)
+{
+  int n;
+
+  acquire(&p->lock);
+  if(waitroom(p, p->size) < 0){
+    release(&p->lock);
+    return -1;
+  }
+  n = p->readopen ? p->nread + p->size - p->nwrite : -1;
+  release(&p->lock);
+  return n;
+}
+
+// Copy as much of addr[0..n) as fits into p without sleeping
+// and return how much that was, or -1 if nobody will read it.
+int
+pipeput(struct pipe *p, char *addr, int n)
+{
+  uint m;
+
+  acquire(&p->lock);
+  if(p->readopen == 0){
+    release(&p->lock);
+    return -1;
+  }
+  m = p->size - (p->nwrite - p->nread);
+  if(m > n)
+    m = n;
+  put(p, addr, m);
+  wakereaders(p);
+  release(&p->lock);
+  return m;
+}
+
 int
 piperead(struct pipe *p, char *addr, int n)
 {
-  int i;
+  uint m;
 
   acquire(&p->lock);
   while(p->nread == p->nwrite && p->writeopen){  //DOC: pipe-empty
@@ -108,14 +246,77 @@ piperead(struct pipe *p, char *addr, int n)
       release(&p->lock);
       return -1;
     }
+    p->nrsleep++;
     sleep(&p->nread, &p->lock); //DOC: piperead-sleep
+    p->nrsleep--;
+  }
+  m = p->nwrite - p->nread;  //DOC: piperead-copy
+  if(m > n)
+    m = n;
+  take(p, addr, m);
+  wakewriters(p);  //DOC: piperead-wakeup
+  release(&p->lock);
+  return m;
+}
+
+// Return the size of p's buffer.
+int
+pipesize(struct pipe *p)
+{
+  return p->size;
+}
+
+// Resize p's buffer to hold at least n bytes, rounding up to
+// a power-of-two number of pages. Fails if the data already in
+// p would not fit. Return the new size.
+int
+pipesetsize(struct pipe *p, int n)
+{
+  char *page[PIPEMAXPAGES], *old;
+  uint i, np, o, m;
+  int r;
+
+  if(n <= 0 || n > PIPEMAXPAGES*PGSIZE)
+    return -1;
+  r = -1;
+  for(np = 1; np*PGSIZE < n; np *= 2)
+    ;
+  memset(page, 0, sizeof(page));
+  for(i = 0; i < np; i++)
+    if((page[i] = kalloc()) == 0)
+      goto bad;
+
+  acquire(&p->lock);
+  if(p->nwrite - p->nread > np*PGSIZE){
+    release(&p->lock);
+    goto bad;
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
-    if(p->nread == p->nwrite)
-      break;
-    addr[i] = p->data[p->nread++ % PIPESIZE];
+  // Move the data to the start of the new pages.
+  for(o = 0; p->nread != p->nwrite; o += m){
+    m = PGSIZE - o%PGSIZE;
+    if(m > p->nwrite - p->nread)
+      m = p->nwrite - p->nread;
+    take(p, page[o/PGSIZE] + o%PGSIZE, m);
   }
-  wakeup(&p->nwrite);  //DOC: piperead-wakeup
+  for(i = 0; i < PIPEMAXPAGES; i++){
+    old = p->page[i];
+    p->page[i] = page[i];
+    page[i] = old;
+  }
+  p->size = r = np*PGSIZE;
+  p->nread = 0;
+  p->nwrite = o;
+  // Writers asleep since before a shrink may want more room
+  // than the new size can ever have.
+  if(p->wneed > p->size/2)
+    p->wneed = p->size/2;
+  wakewriters(p);
   release(&p->lock);
-  return i;
+
+ bad:
+  // The pages not in use: the old ones, or the new ones on failure.
+  for(i = 0; i < PIPEMAXPAGES; i++)
+    if(page[i])
+      kfree(page[i]);
+  return r;
 }
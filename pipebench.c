@@ -0,0 +1,67 @@
+// Pipe throughput benchmark: a child writes TOTAL bytes into a
+// pipe in CHUNK-byte writes while the parent reads them, once
+// for each buffer size, and reports MB/s. Sizes are in pages.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+
+#define TOTAL (8*1024*1024)
+#define CHUNK 8192
+
+char buf[CHUNK];
+int sizes[] = { 1, 4, 16, 64 };
+
+void
+run(int pages)
+{
+  int fds[2], pid, n, total;
+  uint t0, us;
+
+  if(pipe(fds) < 0){
+    printf(1, "pipebench: pipe failed\n");
+    exit();
+  }
+  if(fcntl(fds[1], F_SETPIPE_SZ, pages*4096) != pages*4096){
+    printf(1, "pipebench: cannot size pipe to %d pages\n", pages);
+    exit();
+  }
+  t0 = vclock();
+  if((pid = fork()) < 0){
+    printf(1, "pipebench: fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    close(fds[0]);
+    for(total = 0; total < TOTAL; total += CHUNK)
+      if(write(fds[1], buf, CHUNK) != CHUNK){
+        printf(1, "pipebench: write failed\n");
+        break;
+      }
+    exit();
+  }
+  close(fds[1]);
+  total = 0;
+  while((n = read(fds[0], buf, sizeof(buf))) > 0)
+    total += n;
+  us = vclock() - t0;
+  close(fds[0]);
+  wait();
+  if(total != TOTAL)
+    printf(1, "pipebench: read %d bytes, wanted %d\n", total, TOTAL);
+  if(us == 0)
+    us = 1;
+  printf(1, "pipebench: %d pages: %d.%d MB/s\n", pages,
+         TOTAL / us, TOTAL * 10 / us % 10);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i;
+
+  for(i = 0; i < sizeof(sizes)/sizeof(sizes[0]); i++)
+    run(sizes[i]);
+  exit();
+}
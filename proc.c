@@ -6,10 +6,34 @@
 #include "x86.h"
 #include "proc.h"
 #include "spinlock.h"
-
+#include "rcu.h"
+#include "vdso.h"
+
+// Processes live in pages of PPP, allocated as they are needed.
+// A page whose processes have all been reaped goes back to
+// kalloc, unless its slots are the last free ones, but only
+// after a grace period: lockless pid lookups may still be
+// looking at it.
+struct procpage {
+  struct procpage *next;  // ptable.pages list
+  struct rcuhead rcu;
+  int nused;              // slots not UNUSED
+  struct proc proc[];
+};
+
+#define PPP ((PGSIZE - sizeof(struct procpage)) / sizeof(struct proc))
+#define PROCPAGE(p) ((struct procpage*)PGROUNDDOWN((uint)(p)))
+
+// ptable.lock protects the list of pages, the free list, the
+// pid hash, each process's list of children and its parent
+// pointer, as well as the process states.
 struct {
   struct spinlock lock;
-  struct proc proc[NPROC];
+  struct procpage *pages;
+  struct proc *free;       // UNUSED slots, through hnext
+  int nfree;               // how many
+  int nproc;               // slots in use
+  struct proc *pidhash[NPIDHASH];
 } ptable;
 
 static struct proc *initproc;
@@ -72,6 +96,120 @@ myproc(void) {
   return p;
 }
 
+// Walk every process slot, as in
+//   for(p = pfirst(); p; p = pnext(p))
+// Caller holds ptable.lock.
+static struct proc*
+pfirst(void)
+{
+  return ptable.pages ? ptable.pages->proc : 0;
+}
+
+static struct proc*
+pnext(struct proc *p)
+{
+  struct procpage *pg;
+
+  pg = PROCPAGE(p);
+  if(++p < pg->proc + PPP)
+    return p;
+  return pg->next ? pg->next->proc : 0;
+}
+
+// Add a page of free slots. Caller holds ptable.lock.
+static int
+pgrow(void)
+{
+  struct procpage *pg;
+  struct proc *p;
+
+  if((pg = (struct procpage*)kalloc()) == 0)
+    return -1;
+  memset(pg, 0, PGSIZE);
+  for(p = pg->proc + PPP; p-- > pg->proc; ){
+    p->hnext = ptable.free;
+    ptable.free = p;
+  }
+  pg->next = ptable.pages;
+  ptable.pages = pg;
+  ptable.nfree += PPP;
+  return 0;
+}
+
+static void
+pgfree(struct rcuhead *h)
+{
+  kfree((char*)PROCPAGE(h));
+}
+
+// Give back page pg, none of whose slots are in use.
+// Caller holds ptable.lock.
+static void
+pshrink(struct procpage *pg)
+{
+  struct procpage **ppg;
+  struct proc **pp;
+
+  for(ppg = &ptable.pages; *ppg != pg; ppg = &(*ppg)->next)
+    ;
+  *ppg = pg->next;
+  for(pp = &ptable.free; *pp; ){
+    if(PROCPAGE(*pp) == pg)
+      *pp = (*pp)->hnext;
+    else
+      pp = &(*pp)->hnext;
+  }
+  ptable.nfree -= PPP;
+  rcudefer(&pg->rcu, pgfree);
+}
+
+// Free p's kernel stack and vDSO page, take it out of the
+// pid hash and mark it unused. Caller holds ptable.lock.
+static void
+procfree(struct proc *p)
+{
+  struct proc **pp;
+  struct procpage *pg;
+
+  for(pp = &ptable.pidhash[p->pid % NPIDHASH]; *pp; pp = &(*pp)->hnext){
+    if(*pp == p){
+      *pp = p->hnext;
+      break;
+    }
+  }
+  if(p->kstack){
+    kfree(p->kstack);
+    p->kstack = 0;
+  }
+  if(p->vproc){
+    kfree((char*)p->vproc);
+    p->vproc = 0;
+  }
+  p->pid = 0;
+  p->parent = 0;
+  p->name[0] = 0;
+  p->killed = 0;
+  p->state = UNUSED;
+
+  p->hnext = ptable.free;
+  ptable.free = p;
+  ptable.nfree++;
+  ptable.nproc--;
+  pg = PROCPAGE(p);
+  if(--pg->nused == 0 && ptable.nfree > PPP)
+    pshrink(pg);
+}
+
+// Link child p to the children of parent.
+// Caller holds ptable.lock.
+static void
+adopt(struct proc *parent, struct proc *p)
+{
+  p->parent = parent;
+  p->sibling = parent->child;
+  parent->child = p;
+}
+
 //PAGEBREAK: 32
 // Look in the process table for an UNUSED proc.
 // If found, change state to EMBRYO and initialize
@@ -85,16 +223,24 @@ allocproc(void)
 
   acquire(&ptable.lock);
 
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
-    if(p->state == UNUSED)
-      goto found;
-
-  release(&ptable.lock);
-  return 0;
+  if(ptable.nproc >= NPROC || (ptable.free == 0 && pgrow() < 0)){
+    release(&ptable.lock);
+    return 0;
+  }
+  p = ptable.free;
+  ptable.free = p->hnext;
+  ptable.nfree--;
+  ptable.nproc++;
+  PROCPAGE(p)->nused++;
 
-found:
+  memset(p, 0, sizeof(*p));
   p->state = EMBRYO;
   p->pid = nextpid++;
+  p->hnext = ptable.pidhash[p->pid % NPIDHASH];
+  ptable.pidhash[p->pid % NPIDHASH] = p;
+  p->ofile = p->ofile0;
+  p->fdmap = &p->fdmap0;
+  p->nofile = NOFILE;
   p->value = 20; //Default priority value of process is 20
   p->vruntime = 0;
   p->runtime = 0;
@@ -102,11 +248,16 @@ found:
   // p->time_slice = (int)(10000 * (1024 / CFS_weights[p->value])+0.5);
   release(&ptable.lock);
 
-  // Allocate kernel stack.
-  if((p->kstack = kalloc()) == 0){
-    p->state = UNUSED;
+  // Allocate kernel stack and vDSO page.
+  if((p->kstack = kalloc()) == 0 ||
+     (p->vproc = (struct vproc*)kalloc()) == 0){
+    acquire(&ptable.lock);
+    procfree(p);
+    release(&ptable.lock);
     return 0;
   }
+  memset(p->vproc, 0, PGSIZE);
+  p->vproc->pid = p->pid;
   sp = p->kstack + KSTACKSIZE;
 
   // Leave room for trap frame.
@@ -140,6 +291,8 @@ userinit(void)
   if((p->pgdir = setupkvm()) == 0)
     panic("userinit: out of memory?");
   inituvm(p->pgdir, _binary_initcode_start, (int)_binary_initcode_size);
+  if(vdsomap(p->pgdir, p) < 0)
+    panic("userinit: out of memory?");
   p->sz = PGSIZE;
   memset(p->tf, 0, sizeof(*p->tf));
   p->tf->cs = (SEG_UCODE << 3) | DPL_USER;
@@ -164,54 +317,133 @@ userinit(void)
   release(&ptable.lock);
 }
 
-// Own System Calls
+// Start a kernel thread that runs fn() in process context,
+// e.g. so that it can sleep. fn() must never return.
 int
-getpname(int pid)
+kproc(char *name, void (*fn)(void))
 {
   struct proc *p;
 
-  acquire(&ptable.lock);
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-    if(p->pid == pid){
-        cprintf("%s\n", p->name);
-        release(&ptable.lock);
-        return 0;
-    }
+  if((p = allocproc()) == 0)
+    return -1;
+  if((p->pgdir = setupkvm()) == 0){
+    acquire(&ptable.lock);
+    procfree(p);
+    release(&ptable.lock);
+    return -1;
   }
+  // Have forkret "return" to fn instead of trapret.
+  *(uint*)((char*)p->tf - 4) = (uint)fn;
+  safestrcpy(p->name, name, sizeof(p->name));
+
+  acquire(&ptable.lock);
+  adopt(initproc, p);
+  p->state = RUNNABLE;
   release(&ptable.lock);
-  return -1;
+
+  return p->pid;
+}
+
+// Find the process with the given pid.
+// Caller holds ptable.lock.
+static struct proc*
+pidfind(int pid)
+{
+  struct proc *p;
+
+  for(p = ptable.pidhash[pid % NPIDHASH]; p; p = p->hnext)
+    if(p->pid == pid)
+      return p;
+  return 0;
+}
+
+// Find the process with the given pid without taking
+// ptable.lock. Caller is in a read section, and must check
+// p->pid again after reading p, since p may exit and its slot
+// be reused at any time.
+static struct proc*
+pidlookup(int pid)
+{
+  struct proc *p;
+  int n;
+
+  if(pid <= 0)
+    return 0;
+  n = 0;
+  for(p = ptable.pidhash[pid % NPIDHASH]; p && n < NPROC; p = p->hnext, n++)
+    if(p->pid == pid)
+      return p;
+  // A slot freed and reused under us may have led the walk
+  // into another chain; make sure with the lock held.
+  acquire(&ptable.lock);
+  p = pidfind(pid);
+  release(&ptable.lock);
+  return p;
+}
+
+// Own System Calls
+int
+getpname(int pid)
+{
+  struct proc *p;
+  char name[sizeof(p->name)];
+
+  rcubegin();
+  if((p = pidlookup(pid)) != 0){
+    safestrcpy(name, p->name, sizeof(name));
+    __sync_synchronize();
+    if(p->pid != pid)
+      p = 0;
+  }
+  rcuend();
+  if(p == 0)
+    return -1;
+  cprintf("%s\n", name);
+  return 0;
 }
 
 int
 getnice(int pid)
 {
   struct proc *p;
-  acquire(&ptable.lock);
-  for(p=ptable.proc; p<&ptable.proc[NPROC];p++){
-    if(p->pid == pid){
-      cprintf("%d\n",p->value);
-      release(&ptable.lock);
-      return p->value;
-    }
+  int value;
+
+  rcubegin();
+  if((p = pidlookup(pid)) != 0){
+    value = p->value;
+    __sync_synchronize();
+    if(p->pid != pid)
+      p = 0;
   }
-  release(&ptable.lock);
-  return -1;
+  rcuend();
+  if(p == 0)
+    return -1;
+  cprintf("%d\n", value);
+  return value;
 }
 
 int
 setnice(int pid, int value)
 {
   struct proc *p;
+
+  rcubegin();
+  if((p = pidlookup(pid)) == 0){
+    rcuend();
+    return -1;
+  }
+  // Lock before leaving the read section, so that p's page
+  // cannot be freed before the check below.
   acquire(&ptable.lock);
-  for(p=ptable.proc; p<&ptable.proc[NPROC];p++){
-    if(p->pid == pid){
-      p->value = value;
-      release(&ptable.lock);
-      return 0;
-    }
+  rcuend();
+  if(p->pid != pid){
+    // It exited meanwhile.
+    release(&ptable.lock);
+    return -1;
   }
+  p->value = value;
   release(&ptable.lock);
-  return -1;
+  return 0;
 }
 
 void
@@ -224,7 +456,7 @@ ps(int pid)
   acquire(&ptable.lock);
   cprintf("name\t\tpid\tstate\t\tpriority\truntime/weight\truntime\t\tvruntime\ttick %d\n",ticks);
   if (pid == 0){
-    for(p=ptable.proc; p<&ptable.proc[NPROC]; p++){
+    for(p = pfirst(); p; p = pnext(p)){
       int rw = (int)(p->runtime/CFS_weights[p->value]+0.5);
       if(p->state == SLEEPING)
         cprintf("%s\t\t%d\t%s\t%d\t\t%d\t\t%d\t\t%d\n",p->name,p->pid,"SLEEPING",p->value,rw,p->runtime,p->vruntime);
@@ -234,19 +466,14 @@ ps(int pid)
         cprintf("%s\t\t%d\t%s\t%d\t\t%d\t\t%d\t\t%d\n",p->name,p->pid,"RUNNABLE",p->value,rw,p->runtime,p->vruntime);
     }
   }
-  else{
-    for(p=ptable.proc; p<&ptable.proc[NPROC]; p++){
-      int rw = (int)(p->runtime/CFS_weights[p->value]+0.5);
-      if(p->pid == pid){
-        if(p->state == SLEEPING)
-          cprintf("%s\t\t%d\t%s\t%d\t\t%d\t\t%d\t\t%d\n",p->name,p->pid,"SLEEPING",p->value,rw,p->runtime,p->vruntime);
-        else if(p->state == RUNNING)
-          cprintf("%s\t\t%d\t%s\t\t%d\t\t%d\t\t%d\t\t%d\n",p->name,p->pid,"RUNNING",p->value,rw,p->runtime,p->vruntime);
-        else if(p->state == RUNNABLE)
-          cprintf("%s\t\t%d\t%s\t%d\t\t%d\t\t%d\t\t%d\n",p->name,p->pid,"RUNNABLE",p->value,rw,p->runtime,p->vruntime);
-        break;
-      }
-    }
+  else if(pid > 0 && (p = pidfind(pid)) != 0){
+    int rw = (int)(p->runtime/CFS_weights[p->value]+0.5);
+    if(p->state == SLEEPING)
+      cprintf("%s\t\t%d\t%s\t%d\t\t%d\t\t%d\t\t%d\n",p->name,p->pid,"SLEEPING",p->value,rw,p->runtime,p->vruntime);
+    else if(p->state == RUNNING)
+      cprintf("%s\t\t%d\t%s\t\t%d\t\t%d\t\t%d\t\t%d\n",p->name,p->pid,"RUNNING",p->value,rw,p->runtime,p->vruntime);
+    else if(p->state == RUNNABLE)
+      cprintf("%s\t\t%d\t%s\t%d\t\t%d\t\t%d\t\t%d\n",p->name,p->pid,"RUNNABLE",p->value,rw,p->runtime,p->vruntime);
   }
   release(&ptable.lock);
   return;
@@ -276,7 +503,7 @@ int init_mmap(struct proc *p, int length, int i, uint mmapaddr) {
 
 int make_new_mmap(struct proc *p, uint addr, int length) {
   uint mmap_addr = PGROUNDUP(addr);
-  if (mmap_addr > PGROUNDUP(p->mmaps[p->mmap_index - 1].addr + p->mmaps[p->mmap_index - 1].length)) {
+  if (p->mmap_index == 0 || mmap_addr > PGROUNDUP(p->mmaps[p->mmap_index - 1].addr + p->mmaps[p->mmap_index - 1].length)) {
     return init_mmap(p, length, p->mmap_index-1, mmap_addr);
   }
   int i = 0;
@@ -303,9 +530,15 @@ mmap(int addr, int length, int prot, int flags, int fd, int offset)
   }
   struct proc *p = myproc();
   // over the max number of mmap array
-  if (p->mmap_index == 64) {
+  if (p->mmap_index == NMMAP) {
     return -1;
   }
+  // the array is allocated by the first mmap
+  if (p->mmaps == 0) {
+    if ((p->mmaps = (struct mmap_area*)kalloc()) == 0)
+      return -1;
+    memset(p->mmaps, 0, PGSIZE);
+  }
   // 3 cases
   int i = -1;
   if (flags & MAP_POPULATE) {
@@ -379,6 +612,9 @@ growproc(int n)
     if((sz = allocuvm(curproc->pgdir, sz, sz + n)) == 0)
       return -1;
   } else if(n < 0){
+    // Ring requests may point into the memory.
+    if(ringwait(curproc) < 0)
+      return -1;
     if((sz = deallocuvm(curproc->pgdir, sz, sz + n)) == 0)
       return -1;
   }
@@ -393,7 +629,7 @@ growproc(int n)
 int
 fork(void)
 {
-  int i, pid;
+  int pid;
   struct proc *np;
   struct proc *curproc = myproc();
 
@@ -403,14 +639,16 @@ fork(void)
   }
 
   // Copy process state from proc.
-  if((np->pgdir = copyuvm(curproc->pgdir, curproc->sz)) == 0){
-    kfree(np->kstack);
-    np->kstack = 0;
-    np->state = UNUSED;
+  if((np->pgdir = copyuvm(curproc->pgdir, curproc->sz)) == 0 ||
+     vdsomap(np->pgdir, np) < 0 || fdcopy(np, curproc) < 0){
+    if(np->pgdir)
+      freevm(np->pgdir);
+    acquire(&ptable.lock);
+    procfree(np);
+    release(&ptable.lock);
     return -1;
   }
   np->sz = curproc->sz;
-  np->parent = curproc;
   *np->tf = *curproc->tf;
 
   np->vruntime = curproc->vruntime;
@@ -419,9 +657,6 @@ fork(void)
   // Clear %eax so that fork returns 0 in the child.
   np->tf->eax = 0;
 
-  for(i = 0; i < NOFILE; i++)
-    if(curproc->ofile[i])
-      np->ofile[i] = filedup(curproc->ofile[i]);
   np->cwd = idup(curproc->cwd);
 
   safestrcpy(np->name, curproc->name, sizeof(curproc->name));
@@ -430,6 +665,7 @@ fork(void)
 
   acquire(&ptable.lock);
 
+  adopt(curproc, np);
   np->state = RUNNABLE;
  
   release(&ptable.lock);
@@ -445,17 +681,18 @@ exit(void)
 {
   struct proc *curproc = myproc();
   struct proc *p;
-  int fd;
 
   if(curproc == initproc)
     panic("init exiting");
 
-  // Close all open files.
-  for(fd = 0; fd < NOFILE; fd++){
-    if(curproc->ofile[fd]){
-      fileclose(curproc->ofile[fd]);
-      curproc->ofile[fd] = 0;
-    }
+  // Close all open files, so that ring requests waiting on
+  // pipes this process writes see the end, and then cancel
+  // the rest.
+  fdcloseall(curproc);
+  ringfree(curproc);
+  if(curproc->mmaps){
+    kfree((char*)curproc->mmaps);
+    curproc->mmaps = 0;
   }
 
   begin_op();
@@ -469,12 +706,11 @@ exit(void)
   wakeup1(curproc->parent);
 
   // Pass abandoned children to init.
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-    if(p->parent == curproc){
-      p->parent = initproc;
-      if(p->state == ZOMBIE)
-        wakeup1(initproc);
-    }
+  while((p = curproc->child) != 0){
+    curproc->child = p->sibling;
+    adopt(initproc, p);
+    if(p->state == ZOMBIE)
+      wakeup1(initproc);
   }
 
   // Jump into the scheduler, never to return.
@@ -488,31 +724,23 @@ exit(void)
 int
 wait(void)
 {
-  struct proc *p;
+  struct proc *p, **pp;
   int havekids, pid;
   struct proc *curproc = myproc();
   
   acquire(&ptable.lock);
   for(;;){
-    // Scan through table looking for exited children.
+    // Scan through the children looking for exited ones.
     havekids = 0;
-    for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-      if(p->parent != curproc)
-        continue;
+    for(pp = &curproc->child; (p = *pp) != 0; pp = &p->sibling){
       havekids = 1;
       if(p->state == ZOMBIE){
         // Found one.
+        *pp = p->sibling;
         pid = p->pid;
-        kfree(p->kstack);
-        p->kstack = 0;
         freevm(p->pgdir);
-        p->pid = 0;
-        p->parent = 0;
-        p->name[0] = 0;
-        p->killed = 0;
-        p->state = UNUSED;
+        procfree(p);
         release(&ptable.lock);
-        p->mmap_index = 0;
         return pid;
       }
     }
@@ -549,16 +777,18 @@ scheduler(void)
   for(;;){
     // Enable interrupts on this processor.
     sti();
+    rcupoll();
     // Loop over process table looking for process to run.
     acquire(&ptable.lock);
-    for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+    rcuquiesce();
+    for(p = pfirst(); p; p = pnext(p)){
       if(p->state != RUNNABLE)
         continue;
 
       shortestVruntimeP = p;
       total_weights = 0;
       // select the minimum vruntime p
-      for(p1 = ptable.proc; p1 < &ptable.proc[NPROC]; p1++){
+      for(p1 = pfirst(); p1; p1 = pnext(p1)){
        if(p1->state == RUNNABLE && p1->vruntime < shortestVruntimeP->vruntime) {
         // cprintf("RUNNABLE p pid : %d\n",p->pid);        
 	   	  shortestVruntimeP = p1;
@@ -614,6 +844,7 @@ sched(void)
   if(readeflags()&FL_IF)
     panic("sched interruptible");
   intena = mycpu()->intena;
+  rcuquiesce();  // ncli == 1: not in a read section
   swtch(&p->context, mycpu()->scheduler);
   mycpu()->intena = intena;
 }
@@ -654,8 +885,8 @@ forkret(void)
     // of a regular process (e.g., they call sleep), and thus cannot
     // be run from main().
     first = 0;
-    iinit(ROOTDEV);
     initlog(ROOTDEV);
+    iinit(ROOTDEV);
   }
 
   // Return to "caller", actually trapret (see allocproc).
@@ -708,7 +939,7 @@ wakeup1(void *chan)
 {
   struct proc *p;
 
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+  for(p = pfirst(); p; p = pnext(p))
     if(p->state == SLEEPING && p->chan == chan)
       p->state = RUNNABLE;
 }
@@ -730,25 +961,33 @@ kill(int pid)
 {
   struct proc *p;
 
+  rcubegin();
+  if((p = pidlookup(pid)) == 0){
+    rcuend();
+    return -1;
+  }
+  // As in setnice, lock before leaving the read section.
   acquire(&ptable.lock);
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-    if(p->pid == pid){
-      p->killed = 1;
-      // Wake process from sleep if necessary.
-      if(p->state == SLEEPING)
-        p->state = RUNNABLE;
-      release(&ptable.lock);
-      return 0;
-    }
+  rcuend();
+  if(p->pid != pid){
+    // It exited meanwhile; pids are not reused.
+    release(&ptable.lock);
+    return -1;
   }
+  p->killed = 1;
+  // Wake process from sleep if necessary.
+  if(p->state == SLEEPING)
+    p->state = RUNNABLE;
   release(&ptable.lock);
-  return -1;
+  return 0;
 }
 
 //PAGEBREAK: 36
 // Print a process listing to console.  For debugging.
 // Runs when user types ^P on console.
 // No lock to avoid wedging a stuck machine further.
+// With interrupts off this is a read section, so no page of
+// processes is freed under it.
 void
 procdump(void)
 {
@@ -765,7 +1004,7 @@ procdump(void)
   char *state;
   uint pc[10];
 
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+  for(p = pfirst(); p; p = pnext(p)){
     if(p->state == UNUSED)
       continue;
     if(p->state >= 0 && p->state < NELEM(states) && states[p->state])
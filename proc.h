@@ -8,6 +8,8 @@ struct cpu {
   int ncli;                    // Depth of pushcli nesting.
   int intena;                  // Were interrupts enabled before pushcli?
   struct proc *proc;           // The process running on this cpu or null
+  volatile uint rcuqs;         // Quiescent states passed, for rcu.c
+  uint sysstack[128];          // sysenter's stack; see trapasm.S
 };
 
 extern struct cpu cpus[NCPU];
@@ -49,14 +51,20 @@ struct proc {
   uint sz;                     // Size of process memory (bytes)
   pde_t* pgdir;                // Page table
   char *kstack;                // Bottom of kernel stack for this process
+  struct vproc *vproc;         // Page user space sees at VPROC
   enum procstate state;        // Process state
   int pid;                     // Process ID
   struct proc *parent;         // Parent process
+  struct proc *child;          // First child
+  struct proc *sibling;        // Next child of parent
+  struct proc *hnext;          // Pid hash chain
   struct trapframe *tf;        // Trap frame for current syscall
   struct context *context;     // swtch() here to run process
   void *chan;                  // If non-zero, sleeping on chan
   int killed;                  // If non-zero, have been killed
-  struct file *ofile[NOFILE];  // Open files
+  struct file **ofile;         // Open files, nofile of them
+  uint *fdmap;                 // Bitmap of the open ones
+  int nofile;
   struct inode *cwd;           // Current directory
   char name[16];               // Process name (debugging)
   int value;                   // Priority value
@@ -66,8 +74,13 @@ struct proc {
   uint initial_runtime;        // unit : mili ticks
   uint actual_runtime;          // unit : mili ticks
   uint runtime;                 // uint : mili ticks
-  struct mmap_area mmaps[64];    // mmap array for process
+  struct ring *ring;           // I/O ring mapped at RING, or 0
+  int ringbusy;                // Ring requests not yet completed
+  struct rreq *ringdone;       // Opens waiting for descriptors
+  struct mmap_area *mmaps;       // mmap array for process, allocated by the first mmap
   int mmap_index;                // last mmap index
+  struct file *ofile0[NOFILE];   // ofile until it outgrows them
+  uint fdmap0;
 };
 
 // Process memory is laid out contiguously, low addresses first:
@@ -0,0 +1,133 @@
+// Read-copy update.
+//
+// Lets readers walk shared tables without taking locks.
+// A reader brackets its walk with rcubegin and rcuend, which
+// only turn interrupts off, so it cannot be rescheduled while
+// it looks at an entry. An updater that unlinks an entry must
+// not free or reuse it until every reader that might have seen
+// it is done: rcuwait waits for that, and rcudefer arranges for
+// a function to run afterwards without waiting.
+//
+// A CPU is in a quiescent state, holding nothing from a read
+// section, whenever it switches to or from its scheduler;
+// sched and the scheduler loop count those in cpu->rcuqs.
+// A grace period is over once every CPU has counted one
+// since it began. Readers must not sleep.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "rcu.h"
+
+struct {
+  struct spinlock lock;
+  struct rcuhead *next;  // callbacks for the next grace period
+  struct rcuhead *wait;  // callbacks for the current one
+  uint snap[NCPU];       // quiescent counts when it began
+} rcu;
+
+void
+rcuinit(void)
+{
+  initlock(&rcu.lock, "rcu");
+}
+
+// Begin a read section.
+void
+rcubegin(void)
+{
+  pushcli();
+}
+
+// End a read section.
+void
+rcuend(void)
+{
+  popcli();
+}
+
+// Count a quiescent state on this CPU.
+// Interrupts must be off.
+void
+rcuquiesce(void)
+{
+  mycpu()->rcuqs++;
+}
+
+static void
+rcusnap(uint *snap)
+{
+  int i;
+
+  for(i = 0; i < ncpu; i++)
+    snap[i] = cpus[i].rcuqs;
+}
+
+// Has every CPU passed a quiescent state since snap?
+static int
+rcupassed(uint *snap)
+{
+  int i;
+
+  for(i = 0; i < ncpu; i++)
+    if(cpus[i].rcuqs == snap[i])
+      return 0;
+  return 1;
+}
+
+// Wait until every read section that had begun when
+// rcuwait was called has ended. Caller holds no locks.
+void
+rcuwait(void)
+{
+  uint snap[NCPU];
+
+  rcusnap(snap);
+  while(!rcupassed(snap))
+    yield();
+}
+
+// Call fn(h) once a grace period has passed, from some
+// CPU's scheduler loop. fn must not sleep.
+void
+rcudefer(struct rcuhead *h, void (*fn)(struct rcuhead*))
+{
+  h->fn = fn;
+  acquire(&rcu.lock);
+  h->next = rcu.next;
+  rcu.next = h;
+  release(&rcu.lock);
+}
+
+// Run the callbacks whose grace period is over, and start
+// a grace period for those waiting. The scheduler loop calls
+// this holding no locks.
+void
+rcupoll(void)
+{
+  struct rcuhead *h, *done;
+
+  if(rcu.wait == 0 && rcu.next == 0)
+    return;
+  done = 0;
+  acquire(&rcu.lock);
+  if(rcu.wait && rcupassed(rcu.snap)){
+    done = rcu.wait;
+    rcu.wait = 0;
+  }
+  if(rcu.wait == 0 && rcu.next){
+    rcu.wait = rcu.next;
+    rcu.next = 0;
+    rcusnap(rcu.snap);
+  }
+  release(&rcu.lock);
+
+  while((h = done) != 0){
+    done = h->next;
+    h->fn(h);
+  }
+}
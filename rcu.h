@@ -0,0 +1,6 @@
+// A callback deferred until a grace period has passed,
+// embedded in the object it will free.
+struct rcuhead {
+  struct rcuhead *next;
+  void (*fn)(struct rcuhead*);
+};
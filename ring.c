@@ -0,0 +1,447 @@
+// Asynchronous I/O through a pair of rings shared with the
+// process; see ring.h for the layout.
+//
+// ringenter copies each submission into a request, taking its
+// own reference to the file (or path and cwd) so that the
+// process may close or reuse the descriptor at once, and queues
+// it for a pool of kernel worker threads. A worker runs the
+// request on the process's page table, so the file code moves
+// data straight to and from the user buffer, and posts the
+// result in the completion ring.
+//
+// Installing a descriptor changes the process's file table,
+// which only the process itself may do, so a worker hands an
+// opened file back on p->ringdone; ringenter installs it and
+// posts its completion.
+//
+// The process must leave buffers alone until their requests
+// complete. A shrinking sbrk waits for the process's requests
+// to finish before the memory goes away. exit and exec cancel
+// them: requests no worker has started are dropped, and the
+// workers running the others are killed, which ends a wait
+// for a pipe, say, as it would end the process's own. Workers
+// also skip I/O for a process that has been killed.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "ring.h"
+
+struct rreq {
+  struct rreq *next;
+  struct proc *p;
+  struct proc *worker; // running it, if on ringq.run
+  struct sqe e;
+  struct file *f;
+  struct inode *cwd;   // for RING_OPEN
+  char path[MAXPATH];
+  int res;
+};
+
+struct {
+  struct spinlock lock;
+  struct rreq *head;   // queued for a worker
+  struct rreq *tail;
+  struct rreq *run;    // being carried out
+  struct rreq *free;
+  int started;         // workers running
+  struct rreq req[NRINGREQ];
+} ringq;
+
+static void ringworker(void);
+
+void
+ringinit(void)
+{
+  int i;
+
+  initlock(&ringq.lock, "ring");
+  for(i = 0; i < NRINGREQ; i++){
+    ringq.req[i].next = ringq.free;
+    ringq.free = &ringq.req[i];
+  }
+}
+
+// Map a ring page into the current process at RING,
+// starting the workers the first time any process asks.
+int
+ringsetup(void)
+{
+  struct proc *p = myproc();
+  char *mem;
+  int i, start;
+
+  if(p->ring == 0){
+    if((mem = kalloc()) == 0)
+      return -1;
+    memset(mem, 0, PGSIZE);
+    if(ringmap(p->pgdir, mem) < 0){
+      kfree(mem);
+      return -1;
+    }
+    p->ring = (struct ring*)mem;
+  }
+
+  acquire(&ringq.lock);
+  start = !ringq.started;
+  ringq.started = 1;
+  release(&ringq.lock);
+  if(start)
+    for(i = 0; i < NRINGWORKER; i++)
+      if(kproc("ring", ringworker) < 0)
+        panic("ringsetup: worker");
+  return RING;
+}
+
+// Post a completion. Caller holds ringq.lock and has
+// made sure there is room.
+static void
+post(struct proc *p, uint user, int res)
+{
+  struct ring *r = p->ring;
+  struct cqe *c;
+
+  c = &r->cq[r->cqtail % NCQ];
+  c->user = user;
+  c->res = res;
+  __sync_synchronize();
+  r->cqtail++;
+}
+
+// Install the files workers have opened for p, or close them
+// if p is going away, and post their completions.
+static void
+reap(struct proc *p, int install)
+{
+  struct rreq *q, *next;
+  int fd;
+
+  acquire(&ringq.lock);
+  q = p->ringdone;
+  p->ringdone = 0;
+  release(&ringq.lock);
+
+  for(; q; q = next){
+    next = q->next;
+    fd = -1;
+    if(q->f && (!install || (fd = fdalloc(q->f)) < 0))
+      fileclose(q->f);
+    acquire(&ringq.lock);
+    post(p, q->e.user, fd);
+    p->ringbusy--;
+    q->next = ringq.free;
+    ringq.free = q;
+    release(&ringq.lock);
+  }
+}
+
+// Check submission e and fill in q. Return 0 if a worker
+// should carry it out, or -1 if it fails at once.
+static int
+prepare(struct proc *p, struct sqe *e, struct rreq *q)
+{
+  struct file *f;
+  char *path;
+
+  q->p = p;
+  q->e = *e;
+  q->f = 0;
+  q->cwd = 0;
+
+  if(e->op == RING_OPEN){
+    if(fetchstr(e->addr, &path) < 0 || strlen(path) >= MAXPATH)
+      return -1;
+    safestrcpy(q->path, path, MAXPATH);
+    q->cwd = idup(p->cwd);
+    return 0;
+  }
+
+  if(e->fd < 0 || e->fd >= p->nofile || (f = p->ofile[e->fd]) == 0)
+    return -1;
+  switch(e->op){
+  case RING_READ:
+  case RING_WRITE:
+  case RING_PREAD:
+  case RING_PWRITE:
+    if(e->len < 0 || e->addr >= p->sz || e->addr + e->len > p->sz)
+      return -1;
+    break;
+  case RING_FSYNC:
+    break;
+  case RING_CLOSE:
+    // The descriptor goes now; the worker drops the file.
+    fdclear(p, e->fd);
+    q->f = f;
+    return 0;
+  default:
+    return -1;
+  }
+  q->f = filedup(f);
+  return 0;
+}
+
+// Submit up to n entries from the submission ring, then wait
+// until at least min completions are waiting, or until none
+// of the process's requests are left running. Return the
+// number of entries taken from the submission ring.
+int
+ringenter(int n, int min)
+{
+  struct proc *p = myproc();
+  struct ring *r = p->ring;
+  struct rreq *q;
+  struct sqe e;
+  uint used;
+  int done;
+
+  if(r == 0 || n < 0 || min < 0)
+    return -1;
+
+  reap(p, 1);
+
+  for(done = 0; done < n && r->sqhead != r->sqtail; done++){
+    acquire(&ringq.lock);
+    // Only take as many requests as their completions can fit.
+    used = r->cqtail - r->cqhead;
+    if(used + p->ringbusy >= NCQ || (q = ringq.free) == 0){
+      release(&ringq.lock);
+      break;
+    }
+    ringq.free = q->next;
+    p->ringbusy++;
+    release(&ringq.lock);
+
+    e = r->sq[r->sqhead % NSQ];
+    __sync_synchronize();
+    r->sqhead++;
+
+    q->next = 0;
+    if(prepare(p, &e, q) < 0){
+      acquire(&ringq.lock);
+      post(p, e.user, -1);
+      p->ringbusy--;
+      q->next = ringq.free;
+      ringq.free = q;
+      release(&ringq.lock);
+      continue;
+    }
+
+    acquire(&ringq.lock);
+    if(ringq.head)
+      ringq.tail->next = q;
+    else
+      ringq.head = q;
+    ringq.tail = q;
+    wakeup(&ringq);
+    release(&ringq.lock);
+  }
+
+  for(;;){
+    reap(p, 1);
+    acquire(&ringq.lock);
+    if(r->cqtail - r->cqhead >= min || p->ringbusy == 0 || p->killed)
+      break;
+    if(p->ringdone == 0)
+      sleep(&p->ring, &ringq.lock);
+    release(&ringq.lock);
+  }
+  release(&ringq.lock);
+  return done;
+}
+
+// Carry out q as q->p would have done in a system call.
+static int
+perform(struct rreq *q)
+{
+  struct proc *me = myproc();
+  struct sqe *e = &q->e;
+  struct file *f = q->f;
+  pde_t *pgdir;
+  int res;
+
+  if(q->p->killed && e->op != RING_OPEN && e->op != RING_CLOSE){
+    fileclose(f);
+    return -1;
+  }
+  switch(e->op){
+  case RING_OPEN:
+    me->cwd = q->cwd;
+    q->f = fileopen(q->path, e->len);
+    me->cwd = 0;
+    begin_op();
+    iput(q->cwd);
+    end_op();
+    return 0;
+  case RING_CLOSE:
+    fileclose(f);
+    return 0;
+  case RING_FSYNC:
+    res = filesync(f);
+    break;
+  default:
+    // Borrow q->p's page table to reach its buffer.
+    pgdir = me->pgdir;
+    me->pgdir = q->p->pgdir;
+    switchuvm(me);
+    if(e->op == RING_READ)
+      res = fileread(f, (char*)e->addr, e->len);
+    else if(e->op == RING_WRITE)
+      res = filewrite(f, (char*)e->addr, e->len);
+    else if(e->op == RING_PREAD)
+      res = filepread(f, (char*)e->addr, e->len, e->off);
+    else
+      res = filepwrite(f, (char*)e->addr, e->len, e->off);
+    me->pgdir = pgdir;
+    switchuvm(me);
+    break;
+  }
+  fileclose(f);
+  return res;
+}
+
+// Kernel thread that carries out queued requests.
+static void
+ringworker(void)
+{
+  struct proc *me = myproc();
+  struct rreq *q, **qq;
+  struct proc *p;
+  int res;
+
+  for(;;){
+    acquire(&ringq.lock);
+    while((q = ringq.head) == 0)
+      sleep(&ringq, &ringq.lock);
+    ringq.head = q->next;
+    q->worker = me;
+    q->next = ringq.run;
+    ringq.run = q;
+    release(&ringq.lock);
+
+    res = perform(q);
+
+    p = q->p;
+    acquire(&ringq.lock);
+    for(qq = &ringq.run; *qq != q; qq = &(*qq)->next)
+      ;
+    *qq = q->next;
+    me->killed = 0;  // in case cancel() interrupted q
+    if(q->e.op == RING_OPEN){
+      q->next = p->ringdone;
+      p->ringdone = q;
+    } else {
+      post(p, q->e.user, res);
+      p->ringbusy--;
+      q->next = ringq.free;
+      ringq.free = q;
+    }
+    wakeup(&p->ring);
+    release(&ringq.lock);
+  }
+}
+
+// Give back request q without carrying it out.
+static void
+drop(struct rreq *q)
+{
+  struct proc *p = q->p;
+
+  if(q->f)
+    fileclose(q->f);
+  if(q->cwd){
+    begin_op();
+    iput(q->cwd);
+    end_op();
+  }
+  acquire(&ringq.lock);
+  p->ringbusy--;
+  q->next = ringq.free;
+  ringq.free = q;
+  release(&ringq.lock);
+}
+
+// Take p's requests that no worker has started off the queue,
+// and kill the workers running the others. Return the ones
+// taken. Caller holds ringq.lock.
+static struct rreq*
+cancel(struct proc *p)
+{
+  struct rreq *q, **qq, *taken;
+
+  taken = 0;
+  ringq.tail = 0;
+  for(qq = &ringq.head; (q = *qq) != 0; ){
+    if(q->p == p){
+      *qq = q->next;
+      q->next = taken;
+      taken = q;
+    } else {
+      ringq.tail = q;
+      qq = &q->next;
+    }
+  }
+  for(q = ringq.run; q; q = q->next)
+    if(q->p == p)
+      kill(q->worker->pid);
+  return taken;
+}
+
+// Wait for p's requests to finish. Called before memory they
+// may use goes away. Returns -1 if p is killed meanwhile.
+int
+ringwait(struct proc *p)
+{
+  acquire(&ringq.lock);
+  while(p->ringbusy > 0){
+    if(p->killed){
+      release(&ringq.lock);
+      return -1;
+    }
+    if(p->ringdone){
+      release(&ringq.lock);
+      reap(p, 1);
+      acquire(&ringq.lock);
+      continue;
+    }
+    sleep(&p->ring, &ringq.lock);
+  }
+  release(&ringq.lock);
+  return 0;
+}
+
+// Cancel p's requests, wait for the ones already running to
+// stop, and free p's ring. The page stays mapped in p's page
+// table, which the caller is about to free.
+void
+ringfree(struct proc *p)
+{
+  struct rreq *q, *next;
+
+  if(p->ring == 0)
+    return;
+  acquire(&ringq.lock);
+  q = cancel(p);
+  release(&ringq.lock);
+  for(; q; q = next){
+    next = q->next;
+    drop(q);
+  }
+
+  acquire(&ringq.lock);
+  while(p->ringbusy > 0){
+    if(p->ringdone){
+      release(&ringq.lock);
+      reap(p, 0);
+      acquire(&ringq.lock);
+      continue;
+    }
+    sleep(&p->ring, &ringq.lock);
+  }
+  release(&ringq.lock);
+  kfree((char*)p->ring);
+  p->ring = 0;
+}
@@ -0,0 +1,42 @@
+// Submission and completion rings, shared between a process
+// and the kernel in the page that ringsetup() maps at RING.
+//
+// The process fills sq[sqtail % NSQ] and advances sqtail; the
+// kernel takes entries from sqhead when the process calls
+// ringenter(). The kernel posts each result at cq[cqtail % NCQ]
+// and advances cqtail; the process consumes from cqhead.
+// Results may come in any order: match them by user.
+
+#define RING 0x7FFFD000  // just below VDSO
+#define NSQ  64
+#define NCQ  128
+
+// Operations.
+#define RING_READ   1  // read(fd, addr, len)
+#define RING_WRITE  2  // write(fd, addr, len)
+#define RING_PREAD  3  // pread(fd, addr, len, off)
+#define RING_PWRITE 4  // pwrite(fd, addr, len, off)
+#define RING_FSYNC  5  // fsync(fd)
+#define RING_OPEN   6  // open(addr, len): len is the mode
+#define RING_CLOSE  7  // close(fd)
+
+struct sqe {
+  int op;
+  int fd;
+  uint addr;
+  int len;
+  uint off;
+  uint user;   // handed back in the completion
+};
+
+struct cqe {
+  uint user;
+  int res;     // what the system call would have returned
+};
+
+struct ring {
+  volatile uint sqhead, sqtail;
+  volatile uint cqhead, cqtail;
+  struct sqe sq[NSQ];
+  struct cqe cq[NCQ];
+};
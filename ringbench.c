@@ -0,0 +1,95 @@
+// I/O ring benchmark: read and write a file in 4KB pieces,
+// one pread/pwrite system call each, and again through the
+// submission ring in batches of BATCH requests per ringenter().
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+#include "ring.h"
+
+#define PIECE 4096
+#define NPIECE 256    // 1MB file
+#define BATCH 32
+#define ROUNDS 20
+
+char buf[BATCH][PIECE];
+
+// Run BATCH-sized batches of op over the file through r.
+void
+ringpass(struct ring *r, int op, int fd)
+{
+  struct sqe *e;
+  struct cqe *c;
+  int i, j;
+
+  for(i = 0; i < NPIECE; i += BATCH){
+    for(j = 0; j < BATCH; j++){
+      e = &r->sq[r->sqtail % NSQ];
+      e->op = op;
+      e->fd = fd;
+      e->addr = (uint)buf[j];
+      e->len = PIECE;
+      e->off = (i+j)*PIECE;
+      e->user = j;
+      r->sqtail++;
+    }
+    if(ringenter(BATCH, BATCH) != BATCH){
+      printf(1, "ringbench: ringenter failed\n");
+      exit();
+    }
+    for(; r->cqhead != r->cqtail; r->cqhead++){
+      c = &r->cq[r->cqhead % NCQ];
+      if(c->res != PIECE){
+        printf(1, "ringbench: request %d returned %d\n", c->user, c->res);
+        exit();
+      }
+    }
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct ring *r;
+  int fd, i, k, t0, t1, t2, t3, t4;
+
+  if((fd = open("ringbench.tmp", O_CREATE|O_RDWR)) < 0){
+    printf(1, "ringbench: cannot create file\n");
+    exit();
+  }
+  if((r = (struct ring*)ringsetup()) != (struct ring*)RING){
+    printf(1, "ringbench: ringsetup failed\n");
+    exit();
+  }
+  memset(buf, 'x', sizeof(buf));
+
+  t0 = vuptime();
+  for(k = 0; k < ROUNDS; k++)
+    for(i = 0; i < NPIECE; i++)
+      if(pwrite(fd, buf[i % BATCH], PIECE, i*PIECE) != PIECE){
+        printf(1, "ringbench: pwrite failed\n");
+        exit();
+      }
+  t1 = vuptime();
+  for(k = 0; k < ROUNDS; k++)
+    ringpass(r, RING_PWRITE, fd);
+  t2 = vuptime();
+  for(k = 0; k < ROUNDS; k++)
+    for(i = 0; i < NPIECE; i++)
+      if(pread(fd, buf[i % BATCH], PIECE, i*PIECE) != PIECE){
+        printf(1, "ringbench: pread failed\n");
+        exit();
+      }
+  t3 = vuptime();
+  for(k = 0; k < ROUNDS; k++)
+    ringpass(r, RING_PREAD, fd);
+  t4 = vuptime();
+
+  printf(1, "ringbench: %d x 1MB in 4KB pieces, ticks\n", ROUNDS);
+  printf(1, "  write: syscalls %d, ring %d\n", t1 - t0, t2 - t1);
+  printf(1, "  read:  syscalls %d, ring %d\n", t3 - t2, t4 - t3);
+  close(fd);
+  unlink("ringbench.tmp");
+  exit();
+}
@@ -0,0 +1,102 @@
+// sendfile benchmark: time copying a file into a pipe and into
+// another file with a read/write loop and with sendfile.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fs.h"
+#include "fcntl.h"
+
+#define NBLOCKS 256  // 1MB
+
+char buf[BSIZE];
+
+// Start a process that drains the read end of a pipe,
+// and return the write end.
+int
+drain(void)
+{
+  int p[2];
+
+  if(pipe(p) < 0){
+    printf(1, "sendbench: pipe failed\n");
+    exit();
+  }
+  if(fork() == 0){
+    close(p[1]);
+    while(read(p[0], buf, sizeof(buf)) > 0)
+      ;
+    exit();
+  }
+  close(p[0]);
+  return p[1];
+}
+
+// Copy sbin to out, with sendfile or by read and write.
+int
+copy(int out, int usesend)
+{
+  int in, n, tot, t0;
+
+  if((in = open("sbin", O_RDONLY)) < 0){
+    printf(1, "sendbench: open sbin failed\n");
+    exit();
+  }
+  t0 = vuptime();
+  tot = 0;
+  if(usesend){
+    while((n = sendfile(out, in, -1, NBLOCKS*BSIZE - tot)) > 0)
+      tot += n;
+  } else {
+    while((n = read(in, buf, sizeof(buf))) > 0){
+      if(write(out, buf, n) != n)
+        break;
+      tot += n;
+    }
+  }
+  close(in);
+  if(tot != NBLOCKS*BSIZE){
+    printf(1, "sendbench: copied %d bytes\n", tot);
+    exit();
+  }
+  return vuptime() - t0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int fd, i, t, s;
+
+  if((fd = open("sbin", O_CREATE|O_RDWR)) < 0){
+    printf(1, "sendbench: create sbin failed\n");
+    exit();
+  }
+  for(i = 0; i < NBLOCKS; i++){
+    memset(buf, 'a' + i%26, sizeof(buf));
+    write(fd, buf, sizeof(buf));
+  }
+  close(fd);
+
+  fd = drain();
+  t = copy(fd, 0);
+  close(fd);
+  wait();
+  fd = drain();
+  s = copy(fd, 1);
+  close(fd);
+  wait();
+  printf(1, "sendbench: file to pipe: read/write %d ticks, sendfile %d ticks\n", t, s);
+
+  fd = open("sbout", O_CREATE|O_RDWR);
+  t = copy(fd, 0);
+  close(fd);
+  unlink("sbout");
+  fd = open("sbout", O_CREATE|O_RDWR);
+  s = copy(fd, 1);
+  close(fd);
+  unlink("sbout");
+  printf(1, "sendbench: file to file: read/write %d ticks, sendfile %d ticks\n", t, s);
+
+  unlink("sbin");
+  exit();
+}
@@ -13,20 +13,59 @@
 void
 initsleeplock(struct sleeplock *lk, char *name)
 {
-  initlock(&lk->lk, "sleep lock");
+  static int cls;  // 0 until looked up
+
+  if(cls == 0)
+    cls = lockclass("sleep lock");
+  initlockcls(&lk->lk, "sleep lock", cls);
   lk->name = name;
   lk->locked = 0;
+  lk->owner = 0;
+  lk->nsleep = 0;
   lk->pid = 0;
 }
 
+// A waiter for a lock held by owner calls this with lk held.
+// While owner is running on another CPU it is likely to release
+// the lock soon, so spin without lk until *locked clears, owner
+// stops, or SLEEPSPIN cycles from *t0 have passed, and return 1.
+// Otherwise return 0: the caller should sleep.
+static int
+spinwait(struct spinlock *lk, uint *locked, struct proc *owner, uint64 *t0)
+{
+  if(owner == 0 || owner->state != RUNNING)
+    return 0;
+  if(*t0 == 0)
+    *t0 = rdtsc();
+  if(rdtsc() - *t0 >= SLEEPSPIN)
+    return 0;
+  // The owner's state may change under us; it is only a hint.
+  release(lk);
+  while(*(volatile uint*)locked &&
+        *(volatile enum procstate*)&owner->state == RUNNING &&
+        rdtsc() - *t0 < SLEEPSPIN)
+    asm volatile("pause");
+  acquire(lk);
+  return 1;
+}
+
+// Acquire the lock, spinning first while the holder runs.
 void
 acquiresleep(struct sleeplock *lk)
 {
+  uint64 t0;
+
+  t0 = 0;
   acquire(&lk->lk);
   while (lk->locked) {
+    if(spinwait(&lk->lk, &lk->locked, lk->owner, &t0))
+      continue;
+    lk->nsleep++;
     sleep(lk, &lk->lk);
+    lk->nsleep--;
   }
   lk->locked = 1;
+  lk->owner = myproc();
   lk->pid = myproc()->pid;
   release(&lk->lk);
 }
@@ -36,8 +75,10 @@ releasesleep(struct sleeplock *lk)
 {
   acquire(&lk->lk);
   lk->locked = 0;
+  lk->owner = 0;
   lk->pid = 0;
-  wakeup(lk);
+  if(lk->nsleep)
+    wakeup(lk);
   release(&lk->lk);
 }
 
@@ -52,5 +93,111 @@ holdingsleep(struct sleeplock *lk)
   return r;
 }
 
+void
+initrwsleeplock(struct rwsleeplock *lk, char *name)
+{
+  static int cls;  // 0 until looked up
+
+  if(cls == 0)
+    cls = lockclass("rw sleep lock");
+  initlockcls(&lk->lk, "rw sleep lock", cls);
+  lk->name = name;
+  lk->locked = 0;
+  lk->owner = 0;
+  lk->nread = 0;
+  lk->nwwait = 0;
+  lk->nsleep = 0;
+  lk->pid = 0;
+}
+
+// Acquire the lock for reading. Waits while a writer holds
+// the lock or is waiting for it.
+void
+acquireread(struct rwsleeplock *lk)
+{
+  uint64 t0;
+
+  t0 = 0;
+  acquire(&lk->lk);
+  while(lk->locked || lk->nwwait){
+    if(lk->locked && spinwait(&lk->lk, &lk->locked, lk->owner, &t0))
+      continue;
+    lk->nsleep++;
+    sleep(lk, &lk->lk);
+    lk->nsleep--;
+  }
+  lk->nread++;
+  release(&lk->lk);
+}
+
+void
+releaseread(struct rwsleeplock *lk)
+{
+  acquire(&lk->lk);
+  if(lk->nread < 1)
+    panic("releaseread");
+  if(--lk->nread == 0 && lk->nsleep)
+    wakeup(lk);
+  release(&lk->lk);
+}
+
+// Acquire the lock for writing.
+void
+acquirewrite(struct rwsleeplock *lk)
+{
+  uint64 t0;
+
+  t0 = 0;
+  acquire(&lk->lk);
+  lk->nwwait++;
+  while(lk->locked || lk->nread){
+    if(lk->locked && spinwait(&lk->lk, &lk->locked, lk->owner, &t0))
+      continue;
+    lk->nsleep++;
+    sleep(lk, &lk->lk);
+    lk->nsleep--;
+  }
+  lk->nwwait--;
+  lk->locked = 1;
+  lk->owner = myproc();
+  lk->pid = myproc()->pid;
+  release(&lk->lk);
+}
+
+void
+releasewrite(struct rwsleeplock *lk)
+{
+  acquire(&lk->lk);
+  lk->locked = 0;
+  lk->owner = 0;
+  lk->pid = 0;
+  if(lk->nsleep)
+    wakeup(lk);
+  release(&lk->lk);
+}
 
+// Turn a write hold of the lock into a read hold,
+// letting other readers in.
+void
+downgradewrite(struct rwsleeplock *lk)
+{
+  acquire(&lk->lk);
+  lk->locked = 0;
+  lk->owner = 0;
+  lk->pid = 0;
+  lk->nread++;
+  if(lk->nsleep)
+    wakeup(lk);
+  release(&lk->lk);
+}
 
+int
+holdingwrite(struct rwsleeplock *lk)
+{
+  int r;
+
+  acquire(&lk->lk);
+  r = lk->locked && (lk->pid == myproc()->pid);
+  release(&lk->lk);
+  return r;
+}
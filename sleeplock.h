@@ -2,9 +2,26 @@
 struct sleeplock {
   uint locked;       // Is the lock held?
   struct spinlock lk; // spinlock protecting this sleep lock
-  
+  struct proc *owner; // Process holding lock
+  int nsleep;        // Processes sleeping on the lock
+
   // For debugging:
   char *name;        // Name of lock.
   int pid;           // Process holding lock
 };
 
+// Reader-writer lock for processes: any number of readers,
+// or one writer. Waiting writers keep new readers out.
+struct rwsleeplock {
+  uint locked;       // Is the lock held for writing?
+  struct spinlock lk; // spinlock protecting this lock
+  struct proc *owner; // Process holding lock for writing
+  int nread;         // Processes holding lock for reading
+  int nwwait;        // Writers waiting
+  int nsleep;        // Processes sleeping on the lock
+
+  // For debugging:
+  char *name;        // Name of lock.
+  int pid;           // Process holding lock for writing
+};
+
@@ -9,12 +9,70 @@
 #include "proc.h"
 #include "spinlock.h"
 
+// Lock statistics, kept per lock name since locks such as
+// those of pipes come and go. Each CPU counts into its own row
+// while it has interrupts off, so the counts need no lock.
+// Row 0 collects the locks that did not get a name of their own.
+struct lockcount {
+  uint nacquire;     // acquisitions
+  uint ncontend;     // acquisitions that had to wait
+  uint64 spin;       // cycles spent waiting
+  uint64 maxhold;    // longest time held, in cycles
+};
+
+struct {
+  uint guard;        // serializes adding names
+  int n;
+  char *name[NLOCKSTAT];
+  struct lockcount count[NCPU][NLOCKSTAT];
+} lockstat = { .n = 1, .name = { "other" } };
+
+// Return the lockstat index for name, adding it if it is new.
+// Callers that make locks as they run, such as pipealloc, look
+// the class up once and pass it to initlockcls.
+int
+lockclass(char *name)
+{
+  int i, eflags;
+
+  // The holder must not be preempted. kinit1 gets here before
+  // mpinit has found the CPUs, so turn interrupts off directly
+  // rather than with pushcli, which needs mycpu().
+  eflags = readeflags();
+  cli();
+  while(xchg(&lockstat.guard, 1) != 0)
+    ;
+  for(i = 1; i < lockstat.n; i++)
+    if(lockstat.name[i] == name || strncmp(lockstat.name[i], name, 16) == 0)
+      break;
+  if(i == lockstat.n){
+    if(i < NLOCKSTAT)
+      lockstat.name[lockstat.n++] = name;
+    else
+      i = 0;
+  }
+  xchg(&lockstat.guard, 0);
+  if(eflags & FL_IF)
+    sti();
+  return i;
+}
+
 void
 initlock(struct spinlock *lk, char *name)
+{
+  initlockcls(lk, name, lockclass(name));
+}
+
+// Like initlock, with the class from lockclass(name).
+void
+initlockcls(struct spinlock *lk, char *name, int cls)
 {
   lk->name = name;
   lk->locked = 0;
+  lk->next = 0;
+  lk->owner = 0;
   lk->cpu = 0;
+  lk->cls = cls;
 }
 
 // Acquire the lock.
@@ -24,13 +82,25 @@ initlock(struct spinlock *lk, char *name)
 void
 acquire(struct spinlock *lk)
 {
+  struct lockcount *c;
+  uint ticket;
+  uint64 t0;
+
   pushcli(); // disable interrupts to avoid deadlock.
   if(holding(lk))
     panic("acquire");
 
-  // The xchg is atomic.
-  while(xchg(&lk->locked, 1) != 0)
-    ;
+  // Take a ticket (the fetch-and-add is atomic) and
+  // wait for the holders before us to pass the lock on.
+  c = &lockstat.count[cpuid()][lk->cls];
+  ticket = __sync_fetch_and_add(&lk->next, 1);
+  if(*(volatile uint*)&lk->owner != ticket){
+    t0 = rdtsc();
+    while(*(volatile uint*)&lk->owner != ticket)
+      asm volatile("pause");
+    c->ncontend++;
+    c->spin += rdtsc() - t0;
+  }
 
   // Tell the C compiler and the processor to not move loads or stores
   // past this point, to ensure that the critical section's memory
@@ -38,19 +108,31 @@ acquire(struct spinlock *lk)
   __sync_synchronize();
 
   // Record info about lock acquisition for debugging.
+  lk->locked = 1;
   lk->cpu = mycpu();
   getcallerpcs(&lk, lk->pcs);
+  c->nacquire++;
+  lk->tacquire = rdtsc();
 }
 
 // Release the lock.
 void
 release(struct spinlock *lk)
 {
+  struct lockcount *c;
+  uint64 held;
+
   if(!holding(lk))
     panic("release");
 
+  held = rdtsc() - lk->tacquire;
+  c = &lockstat.count[cpuid()][lk->cls];
+  if(held > c->maxhold)
+    c->maxhold = held;
+
   lk->pcs[0] = 0;
   lk->cpu = 0;
+  lk->locked = 0;
 
   // Tell the C compiler and the processor to not move loads or stores
   // past this point, to ensure that all the stores in the critical
@@ -59,14 +141,55 @@ release(struct spinlock *lk)
   // stores; __sync_synchronize() tells them both not to.
   __sync_synchronize();
 
-  // Release the lock, equivalent to lk->locked = 0.
-  // This code can't use a C assignment, since it might
-  // not be atomic. A real OS would use C atomics here.
-  asm volatile("movl $0, %0" : "+m" (lk->locked) : );
+  // Pass the lock to the next ticket, equivalent to lk->owner++.
+  // Only the holder writes owner, but this code can't use a C
+  // assignment, since it might not be a single store. A real OS
+  // would use C atomics here.
+  asm volatile("movl %1, %0" : "+m" (lk->owner) : "r" (lk->owner + 1));
 
   popcli();
 }
 
+// Print the lock names with the most contended acquisitions.
+// Cycle counts are in units of 1024.
+void
+lockdump(void)
+{
+  static struct lockcount sum[NLOCKSTAT];
+  static int order[NLOCKSTAT];
+  int i, j, k, n;
+  struct lockcount *c;
+
+  n = lockstat.n;
+  for(i = 0; i < n; i++){
+    memset(&sum[i], 0, sizeof(sum[i]));
+    for(j = 0; j < NCPU; j++){
+      c = &lockstat.count[j][i];
+      sum[i].nacquire += c->nacquire;
+      sum[i].ncontend += c->ncontend;
+      sum[i].spin += c->spin;
+      if(c->maxhold > sum[i].maxhold)
+        sum[i].maxhold = c->maxhold;
+    }
+    order[i] = i;
+  }
+  for(i = 0; i < n; i++){
+    for(j = i+1; j < n; j++){
+      if(sum[order[j]].ncontend > sum[order[i]].ncontend){
+        k = order[i];
+        order[i] = order[j];
+        order[j] = k;
+      }
+    }
+  }
+  cprintf("lock            acquired  contended  spin/1K  maxhold/1K\n");
+  for(i = 0; i < n && i < 10; i++){
+    c = &sum[order[i]];
+    cprintf("%s %d %d %d %d\n", lockstat.name[order[i]], c->nacquire,
+            c->ncontend, (uint)(c->spin >> 10), (uint)(c->maxhold >> 10));
+  }
+}
+
 // Record the current call stack in pcs[] by following the %ebp chain.
 void
 getcallerpcs(void *v, uint pcs[])
@@ -1,11 +1,18 @@
 // Mutual exclusion lock.
+// CPUs get the lock in the order they ask for it: each takes
+// a ticket from next and waits until owner reaches it.
 struct spinlock {
   uint locked;       // Is the lock held?
+  uint next;         // Next ticket to hand out.
+  uint owner;        // Ticket of the holder, or of the next one.
 
   // For debugging:
   char *name;        // Name of lock.
   struct cpu *cpu;   // The cpu holding the lock.
   uint pcs[10];      // The call stack (an array of program counters)
                      // that locked the lock.
-};
 
+  // For lockdump:
+  int cls;           // Index of the lock's name in lockstat.
+  uint64 tacquire;   // rdtsc when the lock was acquired.
+};
@@ -1,6 +1,7 @@
 #define T_DIR  1   // Directory
 #define T_FILE 2   // File
 #define T_DEV  3   // Device
+#define T_EXTENT 4 // File mapped by extents
 
 struct stat {
   short type;  // Type of file
@@ -9,3 +10,9 @@ struct stat {
   short nlink; // Number of links to file
   uint size;   // Size of file in bytes
 };
+
+// A directory entry and its inode, as getdents returns them.
+struct dirstat {
+  char name[14+1];     // DIRSIZ plus a terminating 0
+  struct stat st;
+};
@@ -110,6 +110,19 @@ extern int sys_ps(void);
 extern int sys_mmap(void);
 extern int sys_munmap(void);
 extern int sys_freemem(void);
+extern int sys_fsync(void);
+extern int sys_sync(void);
+extern int sys_fallocate(void);
+extern int sys_pread(void);
+extern int sys_pwrite(void);
+extern int sys_readv(void);
+extern int sys_writev(void);
+extern int sys_lseek(void);
+extern int sys_sendfile(void);
+extern int sys_getdents(void);
+extern int sys_ringsetup(void);
+extern int sys_ringenter(void);
+extern int sys_fcntl(void);
 
 static int (*syscalls[])(void) = {
 [SYS_fork]    sys_fork,
@@ -140,6 +153,19 @@ static int (*syscalls[])(void) = {
 [SYS_mmap]    sys_mmap,
 [SYS_munmap]  sys_munmap,
 [SYS_freemem] sys_freemem,
+[SYS_fsync]   sys_fsync,
+[SYS_sync]    sys_sync,
+[SYS_fallocate] sys_fallocate,
+[SYS_pread]   sys_pread,
+[SYS_pwrite]  sys_pwrite,
+[SYS_readv]   sys_readv,
+[SYS_writev]  sys_writev,
+[SYS_lseek]   sys_lseek,
+[SYS_sendfile] sys_sendfile,
+[SYS_getdents] sys_getdents,
+[SYS_ringsetup] sys_ringsetup,
+[SYS_ringenter] sys_ringenter,
+[SYS_fcntl]   sys_fcntl,
 };
 
 void
@@ -26,4 +26,17 @@
 #define SYS_ps      25
 #define SYS_mmap    26
 #define SYS_munmap  27
-#define SYS_freemem 28
\ No newline at end of file
+#define SYS_freemem 28
+#define SYS_fsync  29
+#define SYS_sync   30
+#define SYS_fallocate 31
+#define SYS_pread  32
+#define SYS_pwrite 33
+#define SYS_readv  34
+#define SYS_writev 35
+#define SYS_lseek  36
+#define SYS_sendfile 37
+#define SYS_getdents 38
+#define SYS_ringsetup 39
+#define SYS_ringenter 40
+#define SYS_fcntl  41
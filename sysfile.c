@@ -26,7 +26,7 @@ argfd(int n, int *pfd, struct file **pf)
 
   if(argint(n, &fd) < 0)
     return -1;
-  if(fd < 0 || fd >= NOFILE || (f=myproc()->ofile[fd]) == 0)
+  if(fd < 0 || fd >= myproc()->nofile || (f=myproc()->ofile[fd]) == 0)
     return -1;
   if(pfd)
     *pfd = fd;
@@ -35,23 +35,6 @@ argfd(int n, int *pfd, struct file **pf)
   return 0;
 }
 
-// Allocate a file descriptor for the given file.
-// Takes over file reference from caller on success.
-static int
-fdalloc(struct file *f)
-{
-  int fd;
-  struct proc *curproc = myproc();
-
-  for(fd = 0; fd < NOFILE; fd++){
-    if(curproc->ofile[fd] == 0){
-      curproc->ofile[fd] = f;
-      return fd;
-    }
-  }
-  return -1;
-}
-
 int
 sys_dup(void)
 {
@@ -90,6 +73,142 @@ sys_write(void)
   return filewrite(f, p, n);
 }
 
+int
+sys_pread(void)
+{
+  struct file *f;
+  int n, off;
+  char *p;
+
+  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0 ||
+     argint(3, &off) < 0 || off < 0)
+    return -1;
+  return filepread(f, p, n, off);
+}
+
+int
+sys_pwrite(void)
+{
+  struct file *f;
+  int n, off;
+  char *p;
+
+  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0 ||
+     argint(3, &off) < 0 || off < 0)
+    return -1;
+  return filepwrite(f, p, n, off);
+}
+
+// Fetch the iovec array argument of readv and writev into iov,
+// checking that every buffer lies within the process.
+static int
+argiov(struct iovec *iov, int *cntp)
+{
+  struct iovec *uiov;
+  uint sz;
+  int i, cnt;
+
+  if(argint(2, &cnt) < 0 || cnt < 1 || cnt > IOV_MAX)
+    return -1;
+  if(argptr(1, (char**)&uiov, cnt*sizeof(*uiov)) < 0)
+    return -1;
+  sz = myproc()->sz;
+  for(i = 0; i < cnt; i++){
+    iov[i] = uiov[i];
+    if(iov[i].len < 0 || (uint)iov[i].base >= sz ||
+       (uint)iov[i].base + iov[i].len > sz)
+      return -1;
+  }
+  *cntp = cnt;
+  return 0;
+}
+
+int
+sys_readv(void)
+{
+  struct file *f;
+  struct iovec iov[IOV_MAX];
+  int cnt;
+
+  if(argfd(0, 0, &f) < 0 || argiov(iov, &cnt) < 0)
+    return -1;
+  return filereadv(f, iov, cnt);
+}
+
+int
+sys_writev(void)
+{
+  struct file *f;
+  struct iovec iov[IOV_MAX];
+  int cnt;
+
+  if(argfd(0, 0, &f) < 0 || argiov(iov, &cnt) < 0)
+    return -1;
+  return filewritev(f, iov, cnt);
+}
+
+int
+sys_lseek(void)
+{
+  struct file *f;
+  int off, whence;
+
+  if(argfd(0, 0, &f) < 0 || argint(1, &off) < 0 || argint(2, &whence) < 0)
+    return -1;
+  return filelseek(f, off, whence);
+}
+
+int
+sys_fcntl(void)
+{
+  struct file *f;
+  int cmd, arg;
+
+  if(argfd(0, 0, &f) < 0 || argint(1, &cmd) < 0 || argint(2, &arg) < 0)
+    return -1;
+  return filefcntl(f, cmd, arg);
+}
+
+// Copy n bytes from in_fd, starting at offset off, to out_fd
+// without passing through user space. A negative off means
+// in_fd's own offset, which is then advanced.
+int
+sys_sendfile(void)
+{
+  struct file *out, *in;
+  int off, n, r;
+  uint o;
+
+  if(argfd(0, 0, &out) < 0 || argfd(1, 0, &in) < 0 ||
+     argint(2, &off) < 0 || argint(3, &n) < 0)
+    return -1;
+  if(off >= 0){
+    o = off;
+    return filesend(out, in, &o, n);
+  }
+  if(in->type != FD_INODE)
+    return -1;
+  o = in->off;
+  r = filesend(out, in, &o, n);
+  in->off = o;
+  return r;
+}
+
+int
+sys_getdents(void)
+{
+  struct file *f;
+  int n;
+  struct dirstat *ds;
+
+  // n*sizeof(*ds) must not overflow the check on the buffer.
+  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || n < 0 ||
+     n > 0x7fffffff / sizeof(*ds) ||
+     argptr(1, (char**)&ds, n*sizeof(*ds)) < 0)
+    return -1;
+  return filegetdents(f, ds, n);
+}
+
 int
 sys_close(void)
 {
@@ -98,7 +217,7 @@ sys_close(void)
 
   if(argfd(0, &fd, &f) < 0)
     return -1;
-  myproc()->ofile[fd] = 0;
+  fdclear(myproc(), fd);
   fileclose(f);
   return 0;
 }
@@ -114,6 +233,40 @@ sys_fstat(void)
   return filestat(f, st);
 }
 
+// Make f's data and metadata durable.
+int
+sys_fsync(void)
+{
+  struct file *f;
+
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  return filesync(f);
+}
+
+// Make every file's data and metadata durable.
+int
+sys_sync(void)
+{
+  bflush(ROOTDEV, 0);
+  log_force();
+  return 0;
+}
+
+// Allocate disk blocks for a range of a file up front.
+int
+sys_fallocate(void)
+{
+  struct file *f;
+  int off, len;
+
+  if(argfd(0, 0, &f) < 0 || argint(1, &off) < 0 || argint(2, &len) < 0)
+    return -1;
+  if(off < 0 || len < 0)
+    return -1;
+  return fileallocate(f, off, len);
+}
+
 // Create the path new as a link to the same inode as old.
 int
 sys_link(void)
@@ -218,6 +371,7 @@ sys_unlink(void)
   memset(&de, 0, sizeof(de));
   if(writei(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
     panic("unlink: writei");
+  dcenter(dp->dev, dp->inum, name, 0, 0);
   if(ip->type == T_DIR){
     dp->nlink--;
     iupdate(dp);
@@ -251,13 +405,14 @@ create(char *path, short type, short major, short minor)
   if((ip = dirlookup(dp, name, 0)) != 0){
     iunlockput(dp);
     ilock(ip);
-    if(type == T_FILE && ip->type == T_FILE)
+    if((type == T_FILE || type == T_EXTENT) &&
+       (ip->type == T_FILE || ip->type == T_EXTENT))
       return ip;
     iunlockput(ip);
     return 0;
   }
 
-  if((ip = ialloc(dp->dev, type)) == 0)
+  if((ip = ialloc(dp->dev, type, dp->inum)) == 0)
     panic("create: ialloc");
 
   ilock(ip);
@@ -274,52 +429,57 @@ create(char *path, short type, short major, short minor)
       panic("create dots");
   }
 
-  if(dirlink(dp, name, ip->inum) < 0)
-    panic("create: dirlink");
+  if(dirlink(dp, name, ip->inum) < 0){
+    // A hashed directory can be out of room for name.
+    if(type == T_DIR){
+      dp->nlink--;
+      iupdate(dp);
+    }
+    ip->nlink = 0;
+    iupdate(ip);
+    iunlockput(ip);
+    iunlockput(dp);
+    return 0;
+  }
 
   iunlockput(dp);
 
   return ip;
 }
 
-int
-sys_open(void)
+// Open path as open() does, but return the file
+// without giving it a descriptor.
+struct file*
+fileopen(char *path, int omode)
 {
-  char *path;
-  int fd, omode;
   struct file *f;
   struct inode *ip;
 
-  if(argstr(0, &path) < 0 || argint(1, &omode) < 0)
-    return -1;
-
   begin_op();
 
   if(omode & O_CREATE){
-    ip = create(path, T_FILE, 0, 0);
+    ip = create(path, (omode & O_EXTENT) ? T_EXTENT : T_FILE, 0, 0);
     if(ip == 0){
       end_op();
-      return -1;
+      return 0;
     }
   } else {
     if((ip = namei(path)) == 0){
       end_op();
-      return -1;
+      return 0;
     }
     ilock(ip);
     if(ip->type == T_DIR && omode != O_RDONLY){
       iunlockput(ip);
       end_op();
-      return -1;
+      return 0;
     }
   }
 
-  if((f = filealloc()) == 0 || (fd = fdalloc(f)) < 0){
-    if(f)
-      fileclose(f);
+  if((f = filealloc()) == 0){
     iunlockput(ip);
     end_op();
-    return -1;
+    return 0;
   }
   iunlock(ip);
   end_op();
@@ -329,6 +489,24 @@ sys_open(void)
   f->off = 0;
   f->readable = !(omode & O_WRONLY);
   f->writable = (omode & O_WRONLY) || (omode & O_RDWR);
+  return f;
+}
+
+int
+sys_open(void)
+{
+  char *path;
+  int fd, omode;
+  struct file *f;
+
+  if(argstr(0, &path) < 0 || argint(1, &omode) < 0)
+    return -1;
+  if((f = fileopen(path, omode)) == 0)
+    return -1;
+  if((fd = fdalloc(f)) < 0){
+    fileclose(f);
+    return -1;
+  }
   return fd;
 }
 
@@ -433,7 +611,7 @@ sys_pipe(void)
   fd0 = -1;
   if((fd0 = fdalloc(rf)) < 0 || (fd1 = fdalloc(wf)) < 0){
     if(fd0 >= 0)
-      myproc()->ofile[fd0] = 0;
+      fdclear(myproc(), fd0);
     fileclose(rf);
     fileclose(wf);
     return -1;
@@ -442,3 +620,19 @@ sys_pipe(void)
   fd[1] = fd1;
   return 0;
 }
+
+int
+sys_ringsetup(void)
+{
+  return ringsetup();
+}
+
+int
+sys_ringenter(void)
+{
+  int n, min;
+
+  if(argint(0, &n) < 0 || argint(1, &min) < 0)
+    return -1;
+  return ringenter(n, min);
+}
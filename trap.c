@@ -12,6 +12,7 @@
 // Interrupt descriptor table (shared by all CPUs).
 struct gatedesc idt[256];
 extern uint vectors[];  // in vectors.S: array of 256 entry pointers
+extern char sysenter[], sysenterend[];  // in trapasm.S
 struct spinlock tickslock;
 uint ticks;
 
@@ -33,10 +34,38 @@ idtinit(void)
   lidt(idt, sizeof(idt));
 }
 
+// Was this invalid opcode a sysenter from user space, on a
+// CPU that does not have it?
+static int
+sysenterfault(struct trapframe *tf)
+{
+  struct proc *p = myproc();
+
+  if(p == 0 || (tf->cs&3) != DPL_USER || tf->eip + 2 > p->sz)
+    return 0;
+  return *(ushort*)tf->eip == 0x340f;  // 0f 34: sysenter
+}
+
 //PAGEBREAK: 41
 void
 trap(struct trapframe *tf)
 {
+  if(tf->trapno == T_DEBUG && (tf->cs&3) == 0 &&
+     tf->eip >= (uint)sysenter && tf->eip < (uint)sysenterend){
+    // A user sysenter with TF set; see trapasm.S.
+    tf->eflags &= ~FL_TF;
+    return;
+  }
+
+  if(tf->trapno == T_ILLOP && sysenterfault(tf)){
+    // Carry on as if it had worked, which clears TF too.
+    tf->trapno = T_SYSCALL;
+    tf->eflags &= ~FL_TF;
+    tf->eip = tf->edx;
+    tf->esp = tf->ecx;
+    sti();
+  }
+
   if(tf->trapno == T_SYSCALL){
     if(myproc()->killed)
       exit();
@@ -52,6 +81,7 @@ trap(struct trapframe *tf)
     if(cpuid() == 0){
       acquire(&tickslock);
       ticks++;
+      vdsotick(ticks);
       wakeup(&ticks);
       release(&tickslock);
     }
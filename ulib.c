@@ -3,6 +3,7 @@
 #include "fcntl.h"
 #include "user.h"
 #include "x86.h"
+#include "vdso.h"
 
 char*
 strcpy(char *s, const char *t)
@@ -104,3 +105,52 @@ memmove(void *vdst, const void *vsrc, int n)
     *dst++ = *src++;
   return vdst;
 }
+
+// The v* functions read the kernel's vDSO pages instead of
+// making a system call.
+
+// Same as uptime().
+int
+vuptime(void)
+{
+  return ((struct vdso*)VDSO)->ticks;
+}
+
+// Same as getpid().
+int
+vgetpid(void)
+{
+  return ((struct vproc*)VPROC)->pid;
+}
+
+// The CPU this process last started running on.
+int
+vgetcpu(void)
+{
+  return ((struct vproc*)VPROC)->cpu;
+}
+
+// Microseconds since boot, taking a tick to be TICKUS and
+// interpolating between ticks with the TSC. Wraps after about
+// 71 minutes.
+uint
+vclock(void)
+{
+  struct vdso *v = (struct vdso*)VDSO;
+  uint seq, t, perus, d;
+  uint64 tsc;
+
+  do {
+    while((seq = v->seq) & 1)
+      ;
+    t = v->ticks;
+    tsc = v->tsc;
+    perus = v->tscperus;
+  } while(v->seq != seq);
+  d = 0;
+  if(perus)
+    d = (uint)(rdtsc() - tsc) / perus;
+  if(d >= TICKUS)
+    d = TICKUS - 1;  // the next tick is late
+  return t*TICKUS + d;
+}
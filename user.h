@@ -1,5 +1,7 @@
 struct stat;
 struct rtcdate;
+struct iovec;
+struct dirstat;
 
 // system calls
 int fork(void);
@@ -30,6 +32,19 @@ void ps(int);
 uint mmap(uint,int,int,int,int,int);
 int munmap(uint);
 int freemem(void);
+int fsync(int);
+int sync(void);
+int fallocate(int, int, int);
+int pread(int, void*, int, int);
+int pwrite(int, const void*, int, int);
+int readv(int, const struct iovec*, int);
+int writev(int, const struct iovec*, int);
+int lseek(int, int, int);
+int sendfile(int, int, int, int);
+int getdents(int, struct dirstat*, int);
+uint ringsetup(void);
+int ringenter(int, int);
+int fcntl(int, int, int);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -44,3 +59,7 @@ void* memset(void*, int, uint);
 void* malloc(uint);
 void free(void*);
 int atoi(const char*);
+int vuptime(void);
+int vgetpid(void);
+int vgetcpu(void);
+uint vclock(void);
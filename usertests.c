@@ -7,6 +7,8 @@
 #include "syscall.h"
 #include "traps.h"
 #include "memlayout.h"
+#include "vdso.h"
+#include "ring.h"
 
 char buf[8192];
 char name[3];
@@ -197,7 +199,7 @@ writetest1(void)
     exit();
   }
 
-  for(i = 0; i < MAXFILE; i++){
+  for(i = 0; i < NDIRECT+NINDIRECT; i++){
     ((int*)buf)[0] = i;
     if(write(fd, buf, 512) != 512){
       printf(stdout, "error: write big file failed\n", i);
@@ -217,7 +219,7 @@ writetest1(void)
   for(;;){
     i = read(fd, buf, 512);
     if(i == 0){
-      if(n == MAXFILE - 1){
+      if(n != NDIRECT+NINDIRECT){
         printf(stdout, "read only %d blocks from big", n);
         exit();
       }
@@ -241,6 +243,730 @@ writetest1(void)
   printf(stdout, "big files ok\n");
 }
 
+// fsync() and sync() of delayed writes, and that the
+// data reads back afterwards.
+void
+fsynctest(void)
+{
+  int fd, i;
+
+  printf(stdout, "fsync test\n");
+  fd = open("fsyncf", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf(stdout, "error: creat fsyncf failed!\n");
+    exit();
+  }
+  for(i = 0; i < 20; i++){
+    memset(buf, 'a'+i, 100);
+    if(write(fd, buf, 100) != 100){
+      printf(stdout, "error: write fsyncf failed\n");
+      exit();
+    }
+    if(i % 5 == 4 && fsync(fd) != 0){
+      printf(stdout, "error: fsync failed\n");
+      exit();
+    }
+  }
+  if(fsync(-1) >= 0 || sync() != 0){
+    printf(stdout, "error: fsync(-1) succeeded or sync failed\n");
+    exit();
+  }
+  close(fd);
+
+  fd = open("fsyncf", O_RDONLY);
+  if(fd < 0 || read(fd, buf, 2000) != 2000){
+    printf(stdout, "error: read fsyncf failed\n");
+    exit();
+  }
+  for(i = 0; i < 2000; i++){
+    if(buf[i] != 'a' + i/100){
+      printf(stdout, "error: fsyncf byte %d is %d\n", i, buf[i]);
+      exit();
+    }
+  }
+  close(fd);
+  unlink("fsyncf");
+  printf(stdout, "fsync test ok\n");
+}
+
+// Many processes reading long runs of blocks at once, while
+// another keeps the log busy, must share the buffer cache
+// rather than run out of it.
+void
+bigreadtest(void)
+{
+  enum { NBLK = 64, NREADER = 16, RUN = 16*BSIZE };
+  int fd, i, j, n, pid;
+  char *p;
+
+  printf(stdout, "big read test\n");
+  fd = open("bigrd", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf(stdout, "error: creat bigrd failed\n");
+    exit();
+  }
+  for(i = 0; i < NBLK; i++){
+    memset(buf, i, BSIZE);
+    if(write(fd, buf, BSIZE) != BSIZE){
+      printf(stdout, "error: write bigrd failed\n");
+      exit();
+    }
+  }
+  close(fd);
+
+  for(j = 0; j < NREADER; j++){
+    if((pid = fork()) < 0){
+      printf(stdout, "fork failed\n");
+      exit();
+    }
+    if(pid == 0){
+      if((p = malloc(RUN)) == 0)
+        exit();
+      for(i = 0; i < 4; i++){
+        fd = open("bigrd", O_RDONLY);
+        while((n = read(fd, p, RUN)) > 0)
+          ;
+        if(n < 0){
+          printf(stdout, "error: read bigrd failed\n");
+          exit();
+        }
+        close(fd);
+      }
+      exit();
+    }
+  }
+  // Commit small transactions under the readers.
+  for(i = 0; i < 50; i++){
+    fd = open("bigrw", O_CREATE|O_RDWR);
+    write(fd, buf, 10);
+    close(fd);
+    unlink("bigrw");
+  }
+  for(j = 0; j < NREADER; j++)
+    wait();
+  unlink("bigrd");
+  printf(stdout, "big read ok\n");
+}
+
+// pread, pwrite, readv, writev and lseek.
+void
+piotest(void)
+{
+  int fd;
+  char a[8], b[9];
+  struct iovec iov[2];
+
+  printf(stdout, "positional and vector io test\n");
+  fd = open("pio", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf(stdout, "error: creat pio failed!\n");
+    exit();
+  }
+  iov[0].base = "abcd";
+  iov[0].len = 4;
+  iov[1].base = "efgh";
+  iov[1].len = 4;
+  if(writev(fd, iov, 2) != 8 || lseek(fd, 0, SEEK_CUR) != 8){
+    printf(stdout, "error: writev failed\n");
+    exit();
+  }
+  if(pwrite(fd, "XY", 2, 2) != 2 || lseek(fd, 0, SEEK_CUR) != 8 ||
+     pread(fd, b, 4, 1) != 4 || (b[4] = 0, strcmp(b, "bXYe")) != 0){
+    printf(stdout, "error: pread/pwrite failed\n");
+    exit();
+  }
+  if(lseek(fd, -3, SEEK_END) != 5 || read(fd, b, 3) != 3 ||
+     (b[3] = 0, strcmp(b, "fgh")) != 0 || lseek(fd, -1, SEEK_SET) >= 0){
+    printf(stdout, "error: lseek failed\n");
+    exit();
+  }
+  lseek(fd, 0, SEEK_SET);
+  iov[0].base = a;
+  iov[0].len = 3;
+  iov[1].base = b;
+  iov[1].len = 8;
+  memset(a, 0, sizeof(a));
+  memset(b, 0, sizeof(b));
+  if(readv(fd, iov, 2) != 8 || strcmp(a, "abX") != 0 ||
+     strcmp(b, "Yefgh") != 0){
+    printf(stdout, "error: readv failed\n");
+    exit();
+  }
+  iov[1].base = (void*)0xffffff00;
+  if(readv(fd, iov, 2) >= 0 || readv(fd, iov, 0) >= 0){
+    printf(stdout, "error: readv accepted a bad iovec\n");
+    exit();
+  }
+  close(fd);
+  unlink("pio");
+  printf(stdout, "positional and vector io ok\n");
+}
+
+// sendfile into a pipe and into a file.
+void
+sendfiletest(void)
+{
+  int fd, out, p[2], i, n;
+  char b[16];
+
+  printf(stdout, "sendfile test\n");
+  fd = open("sfin", O_CREATE|O_RDWR);
+  if(fd < 0 || write(fd, "0123456789", 10) != 10){
+    printf(stdout, "error: creat sfin failed!\n");
+    exit();
+  }
+  if(pipe(p) < 0){
+    printf(stdout, "error: pipe failed\n");
+    exit();
+  }
+  if(sendfile(p[1], fd, 2, 5) != 5 || lseek(fd, 0, SEEK_CUR) != 10 ||
+     read(p[0], b, sizeof(b)) != 5 || (b[5] = 0, strcmp(b, "23456")) != 0){
+    printf(stdout, "error: sendfile to pipe failed\n");
+    exit();
+  }
+  close(p[0]);
+  close(p[1]);
+
+  out = open("sfout", O_CREATE|O_RDWR);
+  lseek(fd, 4, SEEK_SET);
+  n = 0;
+  while((i = sendfile(out, fd, -1, 100)) > 0)
+    n += i;
+  if(n != 6 || lseek(fd, 0, SEEK_CUR) != 10 || pread(out, b, 16, 0) != 6 ||
+     (b[6] = 0, strcmp(b, "456789")) != 0 || sendfile(fd, p[0], 0, 1) >= 0){
+    printf(stdout, "error: sendfile to file failed\n");
+    exit();
+  }
+  close(out);
+  close(fd);
+  unlink("sfin");
+  unlink("sfout");
+  printf(stdout, "sendfile ok\n");
+}
+
+// fallocate() allocates without changing the size, and
+// the file then fills in normally.
+void
+fallocatetest(void)
+{
+  int fd, i;
+  struct stat st;
+
+  printf(stdout, "fallocate test\n");
+  fd = open("falloc", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf(stdout, "error: creat falloc failed!\n");
+    exit();
+  }
+  if(fallocate(fd, 0, 20*BSIZE) != 0 || fallocate(-1, 0, BSIZE) >= 0){
+    printf(stdout, "error: fallocate failed\n");
+    exit();
+  }
+  if(fstat(fd, &st) < 0 || st.size != 0){
+    printf(stdout, "error: fallocate changed size to %d\n", st.size);
+    exit();
+  }
+  for(i = 0; i < 20; i++){
+    ((int*)buf)[0] = i;
+    if(write(fd, buf, BSIZE) != BSIZE){
+      printf(stdout, "error: write falloc failed\n");
+      exit();
+    }
+  }
+  close(fd);
+
+  fd = open("falloc", O_RDONLY);
+  for(i = 0; i < 20; i++){
+    if(read(fd, buf, BSIZE) != BSIZE || ((int*)buf)[0] != i){
+      printf(stdout, "error: falloc block %d wrong\n", i);
+      exit();
+    }
+  }
+  close(fd);
+  unlink("falloc");
+
+  // Past the end of the file, the blocks in between come too.
+  fd = open("falloc", O_CREATE|O_RDWR);
+  if(fd < 0 || write(fd, buf, 10) != 10 ||
+     fallocate(fd, 3*BSIZE, 2*BSIZE) != 0){
+    printf(stdout, "error: fallocate past end failed\n");
+    exit();
+  }
+  if(fstat(fd, &st) < 0 || st.size != 10){
+    printf(stdout, "error: fallocate past end changed size to %d\n", st.size);
+    exit();
+  }
+  for(i = 0; i < 5; i++){
+    ((int*)buf)[0] = i;
+    if(pwrite(fd, buf, BSIZE, i*BSIZE) != BSIZE ||
+       pread(fd, buf, BSIZE, i*BSIZE) != BSIZE || ((int*)buf)[0] != i){
+      printf(stdout, "error: falloc block %d past end wrong\n", i);
+      exit();
+    }
+  }
+  close(fd);
+  unlink("falloc");
+  printf(stdout, "fallocate test ok\n");
+}
+
+// does path name an existing file?
+int
+exists(char *path)
+{
+  int fd;
+
+  if((fd = open(path, O_RDONLY)) < 0)
+    return 0;
+  close(fd);
+  return 1;
+}
+
+// names must stay right as the directory entry cache
+// remembers them: after unlink, after relinking, and after
+// the directory itself is removed and its inode reused.
+void
+dcachetest(void)
+{
+  int fd, i;
+
+  printf(stdout, "dcache test\n");
+  if(mkdir("dcd") < 0){
+    printf(stdout, "error: mkdir dcd failed\n");
+    exit();
+  }
+  for(i = 0; i < 3; i++){
+    if(exists("dcd/x")){
+      printf(stdout, "error: dcd/x exists before creation\n");
+      exit();
+    }
+    fd = open("dcd/x", O_CREATE|O_RDWR);
+    if(fd < 0){
+      printf(stdout, "error: create dcd/x failed\n");
+      exit();
+    }
+    close(fd);
+    if(!exists("dcd/x") || link("dcd/x", "dcd/y") < 0){
+      printf(stdout, "error: dcd/x missing after creation\n");
+      exit();
+    }
+    if(unlink("dcd/x") < 0 || exists("dcd/x") || !exists("dcd/y")){
+      printf(stdout, "error: dcd/x still there after unlink\n");
+      exit();
+    }
+    if(unlink("dcd/y") < 0){
+      printf(stdout, "error: unlink dcd/y failed\n");
+      exit();
+    }
+  }
+  fd = open("dcd/z", O_CREATE|O_RDWR);
+  close(fd);
+  unlink("dcd/z");
+  if(unlink("dcd") < 0){
+    printf(stdout, "error: unlink dcd failed\n");
+    exit();
+  }
+  // a new directory may get the old one's inode number.
+  if(mkdir("dce") < 0 || exists("dcd/z") || exists("dce/z") ||
+     !exists("dce/.")){
+    printf(stdout, "error: stale names after unlink dcd\n");
+    exit();
+  }
+  unlink("dce");
+  printf(stdout, "dcache test ok\n");
+}
+
+// getdents returns every entry once, with its stat.
+void
+getdentstest(void)
+{
+  struct dirstat ds[4];
+  int fd, i, n, tot, seen;
+
+  printf(stdout, "getdents test\n");
+  if(mkdir("gdd") < 0){
+    printf(stdout, "error: mkdir gdd failed\n");
+    exit();
+  }
+  fd = open("gdd/a", O_CREATE|O_RDWR);
+  write(fd, "hello", 5);
+  close(fd);
+  close(open("gdd/b", O_CREATE|O_RDWR));
+  mkdir("gdd/c");
+  unlink("gdd/b");
+
+  fd = open("gdd", O_RDONLY);
+  tot = seen = 0;
+  while((n = getdents(fd, ds, 2)) > 0){
+    for(i = 0; i < n; i++){
+      tot++;
+      if(strcmp(ds[i].name, "a") == 0 && ds[i].st.type == T_FILE &&
+         ds[i].st.size == 5)
+        seen |= 1;
+      if(strcmp(ds[i].name, "c") == 0 && ds[i].st.type == T_DIR)
+        seen |= 2;
+      if(strcmp(ds[i].name, "b") == 0)
+        seen |= 4;
+    }
+  }
+  if(n < 0 || tot != 4 || seen != 3){
+    printf(stdout, "error: getdents returned %d entries\n", tot);
+    exit();
+  }
+  // A count whose size in bytes wraps around must not pass.
+  if(getdents(fd, ds, 0x7fffffff / sizeof(ds[0]) + 2) != -1){
+    printf(stdout, "error: getdents took a huge count\n");
+    exit();
+  }
+  close(fd);
+  unlink("gdd/c");
+  unlink("gdd/a");
+  unlink("gdd");
+  printf(stdout, "getdents ok\n");
+}
+
+// the vDSO pages agree with the system calls, and user
+// programs cannot write them.
+void
+vdsotest(void)
+{
+  int i, pid;
+  uint t, t1;
+
+  printf(stdout, "vdso test\n");
+  if(vgetpid() != getpid()){
+    printf(stdout, "error: vgetpid %d getpid %d\n", vgetpid(), getpid());
+    exit();
+  }
+  t = uptime();
+  if(vuptime() < t || vuptime() > t + 1){
+    printf(stdout, "error: vuptime %d uptime %d\n", vuptime(), t);
+    exit();
+  }
+  if(vgetcpu() < 0 || vgetcpu() >= 8){
+    printf(stdout, "error: vgetcpu %d\n", vgetcpu());
+    exit();
+  }
+  t = vclock();
+  for(i = 0; i < 1000; i++){
+    if((t1 = vclock()) < t){
+      printf(stdout, "error: vclock went back from %d to %d\n", t, t1);
+      exit();
+    }
+    t = t1;
+  }
+  pid = fork();
+  if(pid == 0){
+    if(vgetpid() != getpid())
+      printf(stdout, "error: child vgetpid %d\n", vgetpid());
+    *(int*)VPROC = 1;
+    printf(stdout, "error: wrote the vDSO\n");
+    exit();
+  }
+  if(pid < 0 || wait() != pid){
+    printf(stdout, "error: fork/wait\n");
+    exit();
+  }
+  printf(stdout, "vdso ok\n");
+}
+
+static void
+ringsub(struct ring *r, int op, int fd, void *addr, int len, uint off, uint user)
+{
+  struct sqe *e;
+
+  e = &r->sq[r->sqtail % NSQ];
+  e->op = op;
+  e->fd = fd;
+  e->addr = (uint)addr;
+  e->len = len;
+  e->off = off;
+  e->user = user;
+  r->sqtail++;
+}
+
+// Take the next completion, which must be for user.
+static int
+ringres(struct ring *r, uint user)
+{
+  struct cqe *c;
+
+  if(r->cqhead == r->cqtail){
+    printf(stdout, "error: ring: no completion for %d\n", user);
+    exit();
+  }
+  c = &r->cq[r->cqhead % NCQ];
+  if(c->user != user){
+    printf(stdout, "error: ring: completion %d, wanted %d\n", c->user, user);
+    exit();
+  }
+  r->cqhead++;
+  return c->res;
+}
+
+// Submission and completion rings.
+void
+ringtest(void)
+{
+  enum { NB = 8 };
+  static char buf[NB][512];
+  struct ring *r;
+  int i, fd, n, seen, fds[2];
+  struct cqe *c;
+
+  printf(stdout, "ring test\n");
+  r = (struct ring*)ringsetup();
+  if((uint)r != RING || r->sqhead != 0 || r->cqtail != 0){
+    printf(stdout, "error: ringsetup %x\n", r);
+    exit();
+  }
+
+  ringsub(r, RING_OPEN, 0, "ringf", O_CREATE|O_RDWR, 0, 1);
+  if(ringenter(1, 1) != 1 || (fd = ringres(r, 1)) < 0){
+    printf(stdout, "error: ring open\n");
+    exit();
+  }
+
+  // A batch of writes, finished in any order.
+  for(i = 0; i < NB; i++){
+    memset(buf[i], 'a'+i, sizeof(buf[i]));
+    ringsub(r, RING_PWRITE, fd, buf[i], sizeof(buf[i]), i*sizeof(buf[i]), 100+i);
+  }
+  if(ringenter(NB, NB) != NB){
+    printf(stdout, "error: ring pwrite submit\n");
+    exit();
+  }
+  for(seen = 0; r->cqhead != r->cqtail; r->cqhead++){
+    c = &r->cq[r->cqhead % NCQ];
+    if(c->user < 100 || c->user >= 100+NB || c->res != sizeof(buf[0])){
+      printf(stdout, "error: ring pwrite %d res %d\n", c->user, c->res);
+      exit();
+    }
+    seen |= 1 << (c->user - 100);
+  }
+  if(seen != (1 << NB) - 1){
+    printf(stdout, "error: ring pwrite completions %x\n", seen);
+    exit();
+  }
+
+  ringsub(r, RING_FSYNC, fd, 0, 0, 0, 2);
+  if(ringenter(1, 1) != 1 || ringres(r, 2) != 0){
+    printf(stdout, "error: ring fsync\n");
+    exit();
+  }
+
+  // Read it back with plain reads, which share the file offset.
+  memset(buf, 0, sizeof(buf));
+  for(i = 0; i < NB; i++){
+    ringsub(r, RING_READ, fd, buf[i], sizeof(buf[i]), 0, 200+i);
+    if(ringenter(1, 1) != 1 || ringres(r, 200+i) != sizeof(buf[i])){
+      printf(stdout, "error: ring read %d\n", i);
+      exit();
+    }
+    for(n = 0; n < sizeof(buf[i]); n++)
+      if(buf[i][n] != 'a'+i){
+        printf(stdout, "error: ring read %d got %x\n", i, buf[i][n]);
+        exit();
+      }
+  }
+
+  // Bad requests fail in their completions.
+  ringsub(r, RING_READ, fd, (void*)0x7FFF0000, 512, 0, 3);
+  ringsub(r, RING_READ, 99, buf[0], 512, 0, 4);
+  if(ringenter(2, 2) != 2 || ringres(r, 3) != -1 || ringres(r, 4) != -1){
+    printf(stdout, "error: ring bad requests\n");
+    exit();
+  }
+
+  ringsub(r, RING_CLOSE, fd, 0, 0, 0, 5);
+  if(ringenter(1, 1) != 1 || ringres(r, 5) != 0 || write(fd, buf, 1) != -1){
+    printf(stdout, "error: ring close\n");
+    exit();
+  }
+  if(unlink("ringf") < 0){
+    printf(stdout, "error: unlink ringf\n");
+    exit();
+  }
+
+  // Exiting cancels a read that only the exiting process
+  // could finish, and frees its worker. Do it more times
+  // than there are workers.
+  for(i = 0; i < 2*NRINGWORKER; i++){
+    n = fork();
+    if(n < 0){
+      printf(stdout, "error: fork failed\n");
+      exit();
+    }
+    if(n == 0){
+      r = (struct ring*)ringsetup();
+      if(pipe(fds) != 0)
+        exit();
+      ringsub(r, RING_READ, fds[0], buf[0], 1, 0, 6);
+      ringenter(1, 0);
+      exit();
+    }
+    if(wait() != n){
+      printf(stdout, "error: wait\n");
+      exit();
+    }
+  }
+  r = (struct ring*)RING;
+  ringsub(r, RING_FSYNC, 0, 0, 0, 0, 7);
+  if(ringenter(1, 1) != 1 || ringres(r, 7) != 0){
+    printf(stdout, "error: ring workers stuck after exit\n");
+    exit();
+  }
+  printf(stdout, "ring ok\n");
+}
+
+// a process's descriptor table grows past NOFILE, hands out
+// the lowest free descriptor, and is copied by fork.
+void
+fdtabletest(void)
+{
+  int fd, i, n, pid;
+  int fds[100];
+
+  printf(stdout, "fd table test\n");
+  n = 0;
+  for(i = 0; i < 100; i++){
+    if((fds[i] = dup(1)) < 0)
+      break;
+    n++;
+  }
+  if(n != 100 || fds[99] <= 16){
+    printf(stdout, "error: only %d dups\n", n);
+    exit();
+  }
+  close(fds[10]);
+  close(fds[50]);
+  if((fd = dup(1)) != fds[10]){
+    printf(stdout, "error: dup gave %d not %d\n", fd, fds[10]);
+    exit();
+  }
+  fds[10] = fd;
+  pid = fork();
+  if(pid == 0){
+    // The child's table is as big as the parent's.
+    if(write(fds[99], "", 0) != 0 || dup(1) != fds[50]){
+      printf(stdout, "error: child fd table\n");
+    }
+    exit();
+  }
+  wait();
+  for(i = 0; i < 100; i++)
+    if(i != 50)
+      close(fds[i]);
+  if((fd = dup(1)) != 3){
+    printf(stdout, "error: dup after close gave %d\n", fd);
+    exit();
+  }
+  close(fd);
+  printf(stdout, "fd table ok\n");
+}
+
+// A lookup that races with the unlink of the same name must
+// find the file or not find it, never a freed inode.
+void
+lookupunlinktest(void)
+{
+  int fd, i, pid;
+  struct stat st;
+
+  printf(stdout, "lookup/unlink test\n");
+  mkdir("lku");
+  close(open("lku/f", O_CREATE|O_RDWR));
+  pid = fork();
+  if(pid < 0){
+    printf(stdout, "fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    for(i = 0; i < 500; i++){
+      unlink("lku/f");
+      fd = open("lku/f", O_CREATE|O_RDWR);
+      write(fd, "x", 1);
+      close(fd);
+    }
+    exit();
+  }
+  for(i = 0; i < 2000; i++){
+    if((fd = open("lku/f", O_RDONLY)) < 0)
+      continue;
+    if(fstat(fd, &st) < 0 || st.type != T_FILE){
+      printf(stdout, "error: lku/f has type %d\n", st.type);
+      exit();
+    }
+    close(fd);
+  }
+  wait();
+  unlink("lku/f");
+  unlink("lku");
+  printf(stdout, "lookup/unlink ok\n");
+}
+
+// path lookups and kill() take no locks; check that they
+// stay right while other processes change the tables.
+void
+lookuptest(void)
+{
+  int fd, i, j, pid, pids[3];
+  char name[8];
+
+  printf(stdout, "lockless lookup test\n");
+  mkdir("lkd");
+  fd = open("lkd/keep", O_CREATE|O_RDWR);
+  close(fd);
+  for(j = 0; j < 3; j++){
+    if((pids[j] = fork()) < 0){
+      printf(stdout, "fork failed\n");
+      exit();
+    }
+    if(pids[j] == 0){
+      for(i = 0; i < 300; i++){
+        if((fd = open("lkd/keep", O_RDONLY)) < 0){
+          printf(stdout, "error: lkd/keep vanished\n");
+          exit();
+        }
+        close(fd);
+        if(open("lkd/gone", O_RDONLY) >= 0){
+          printf(stdout, "error: lkd/gone appeared\n");
+          exit();
+        }
+      }
+      exit();
+    }
+  }
+  // Churn the directory under the lookups.
+  strcpy(name, "lkd/t0");
+  for(i = 0; i < 200; i++){
+    name[5] = '0' + i % 10;
+    close(open(name, O_CREATE|O_RDWR));
+    unlink(name);
+  }
+  for(j = 0; j < 3; j++)
+    wait();
+
+  // A reaped child's pid is gone.
+  for(j = 0; j < 3; j++){
+    if(kill(pids[j]) != -1){
+      printf(stdout, "error: kill of exited pid %d\n", pids[j]);
+      exit();
+    }
+  }
+  pid = fork();
+  if(pid == 0){
+    for(;;)
+      sleep(1);
+  }
+  if(kill(pid) != 0 || wait() != pid){
+    printf(stdout, "error: kill of live pid failed\n");
+    exit();
+  }
+  unlink("lkd/keep");
+  unlink("lkd");
+  printf(stdout, "lockless lookup ok\n");
+}
+
 void
 createtest(void)
 {
@@ -354,6 +1080,62 @@ pipe1(void)
   printf(1, "pipe1 ok\n");
 }
 
+// Pipe buffer sizes, and data that wraps around a resized pipe.
+void
+pipesizetest(void)
+{
+  enum { BIG = 3*4096 + 100 };
+  static char big[BIG];
+  int fds[2], i, j, n;
+
+  printf(1, "pipesize test\n");
+  if(pipe(fds) != 0){
+    printf(1, "pipe() failed\n");
+    exit();
+  }
+  if(fcntl(fds[0], F_GETPIPE_SZ, 0) != PIPEPAGES*4096 ||
+     fcntl(fds[1], F_SETPIPE_SZ, PIPEMAXPAGES*4096 + 1) != -1 ||
+     fcntl(1, F_GETPIPE_SZ, 0) != -1){
+    printf(1, "error: pipe sizes\n");
+    exit();
+  }
+  for(i = 0; i < BIG; i++)
+    big[i] = i;
+
+  // The data must fit in the new size.
+  if(write(fds[1], big, 5000) != 5000 ||
+     fcntl(fds[1], F_SETPIPE_SZ, 4096) != -1 ||
+     read(fds[0], buf, 5000) != 5000 ||
+     fcntl(fds[1], F_SETPIPE_SZ, 1) != 4096){
+    printf(1, "error: pipe shrink\n");
+    exit();
+  }
+
+  // Leave the data wrapped around the end of the ring,
+  // then grow the pipe under it.
+  if(write(fds[1], big, 3000) != 3000 || read(fds[0], buf, 3000) != 3000 ||
+     write(fds[1], big, 4000) != 4000 ||
+     fcntl(fds[1], F_SETPIPE_SZ, 3*4096) != 4*4096 ||
+     write(fds[1], big+4000, BIG-4000) != BIG-4000){
+    printf(1, "error: pipe grow\n");
+    exit();
+  }
+  for(i = 0; i < BIG; i += n){
+    if((n = read(fds[0], buf, sizeof(buf))) <= 0){
+      printf(1, "error: pipe read after resize\n");
+      exit();
+    }
+    for(j = 0; j < n; j++)
+      if(buf[j] != big[i+j]){
+        printf(1, "error: pipe data at %d\n", i+j);
+        exit();
+      }
+  }
+  close(fds[0]);
+  close(fds[1]);
+  printf(1, "pipesize ok\n");
+}
+
 // meant to be run w/ at most two CPUs
 void
 preempt(void)
@@ -931,6 +1713,138 @@ bigdir(void)
   printf(1, "bigdir ok\n");
 }
 
+// a directory that outgrows one block becomes hashed;
+// its names must stay reachable and removable.
+void
+hashdir(void)
+{
+  int i, fd;
+  char name[10];
+
+  printf(1, "hashdir test\n");
+  if(mkdir("hd") < 0){
+    printf(1, "hashdir mkdir failed\n");
+    exit();
+  }
+  name[0] = 'h';
+  name[1] = 'd';
+  name[2] = '/';
+  name[6] = '\0';
+  for(i = 0; i < 1000; i++){
+    name[3] = '0' + i/100;
+    name[4] = '0' + (i/10)%10;
+    name[5] = '0' + i%10;
+    if((fd = open(name, O_CREATE|O_RDWR)) < 0){
+      printf(1, "hashdir create %s failed\n", name);
+      exit();
+    }
+    close(fd);
+  }
+  for(i = 0; i < 1000; i++){
+    name[3] = '0' + i/100;
+    name[4] = '0' + (i/10)%10;
+    name[5] = '0' + i%10;
+    if(!exists(name) || ((i&1) && unlink(name) < 0)){
+      printf(1, "hashdir lookup %s failed\n", name);
+      exit();
+    }
+  }
+  if(!exists("hd/.") || !exists("hd/..") || exists("hd/001") ||
+     unlink("hd") == 0){
+    printf(1, "hashdir bad lookup\n");
+    exit();
+  }
+  for(i = 0; i < 1000; i += 2){
+    name[3] = '0' + i/100;
+    name[4] = '0' + (i/10)%10;
+    name[5] = '0' + i%10;
+    if(unlink(name) < 0){
+      printf(1, "hashdir unlink %s failed\n", name);
+      exit();
+    }
+  }
+  if(unlink("hd") < 0){
+    printf(1, "hashdir unlink hd failed\n");
+    exit();
+  }
+  printf(1, "hashdir ok\n");
+}
+
+// FNV-1a, as the kernel hashes directory entry names.
+uint
+fnv1a(char *s)
+{
+  uint h;
+
+  h = 2166136261;
+  for(; *s; s++)
+    h = (h ^ (uchar)*s) * 16777619;
+  return h;
+}
+
+// names whose hashes share their top 8 bits crowd into one
+// leaf that takes more splits than one create may make; such
+// a create must fail cleanly, and trying again must get further.
+void
+hashcollide(void)
+{
+  int i, n, fd, tries, fails;
+  char name[10];
+
+  printf(1, "hashcollide test\n");
+  if(mkdir("hc") < 0){
+    printf(1, "hashcollide mkdir failed\n");
+    exit();
+  }
+  name[0] = 'h';
+  name[1] = 'c';
+  name[2] = '/';
+  name[3] = 'c';
+  name[9] = '\0';
+  fails = 0;
+  for(i = n = 0; n < 300; i++){
+    name[4] = '0' + i/10000;
+    name[5] = '0' + (i/1000)%10;
+    name[6] = '0' + (i/100)%10;
+    name[7] = '0' + (i/10)%10;
+    name[8] = '0' + i%10;
+    if(fnv1a(name+3) >> 24 != 0)
+      continue;
+    n++;
+    for(tries = 0; (fd = open(name, O_CREATE|O_RDWR)) < 0; tries++){
+      if(tries == 20 || exists(name)){
+        printf(1, "hashcollide create %s failed\n", name);
+        exit();
+      }
+      fails++;
+    }
+    close(fd);
+  }
+  if(fails == 0){
+    printf(1, "hashcollide: no create ran out of splits\n");
+    exit();
+  }
+  for(i = n = 0; n < 300; i++){
+    name[4] = '0' + i/10000;
+    name[5] = '0' + (i/1000)%10;
+    name[6] = '0' + (i/100)%10;
+    name[7] = '0' + (i/10)%10;
+    name[8] = '0' + i%10;
+    if(fnv1a(name+3) >> 24 != 0)
+      continue;
+    n++;
+    if(unlink(name) < 0){
+      printf(1, "hashcollide unlink %s failed\n", name);
+      exit();
+    }
+  }
+  if(unlink("hc") < 0){
+    printf(1, "hashcollide unlink hc failed\n");
+    exit();
+  }
+  printf(1, "hashcollide ok\n");
+}
+
 void
 subdir(void)
 {
@@ -1144,6 +2058,131 @@ bigwrite(void)
   printf(1, "bigwrite ok\n");
 }
 
+// write a file that reaches into the doubly-indirect
+// blocks, then check every block and remove it.
+void
+hugefile(void)
+{
+  int fd, i, j, nb, nio;
+
+  printf(1, "hugefile test\n");
+
+  nio = sizeof(buf) / BSIZE;
+  nb = NDIRECT + NINDIRECT + NINDIRECT/2;
+  nb -= nb % nio;
+  unlink("hugefile");
+  fd = open("hugefile", O_CREATE | O_RDWR);
+  if(fd < 0){
+    printf(1, "cannot create hugefile\n");
+    exit();
+  }
+  for(i = 0; i < nb; i += nio){
+    for(j = 0; j < nio; j++)
+      ((int*)buf)[j*BSIZE/sizeof(int)] = i + j;
+    if(write(fd, buf, nio*BSIZE) != nio*BSIZE){
+      printf(1, "write hugefile failed at block %d\n", i);
+      exit();
+    }
+  }
+  close(fd);
+
+  fd = open("hugefile", 0);
+  if(fd < 0){
+    printf(1, "cannot open hugefile\n");
+    exit();
+  }
+  for(i = 0; i < nb; i += nio){
+    if(read(fd, buf, nio*BSIZE) != nio*BSIZE){
+      printf(1, "read hugefile failed at block %d\n", i);
+      exit();
+    }
+    for(j = 0; j < nio; j++){
+      if(((int*)buf)[j*BSIZE/sizeof(int)] != i + j){
+        printf(1, "hugefile block %d has wrong data\n", i + j);
+        exit();
+      }
+    }
+  }
+  if(read(fd, buf, 1) != 0){
+    printf(1, "hugefile too long\n");
+    exit();
+  }
+  close(fd);
+  if(unlink("hugefile") < 0){
+    printf(1, "unlink hugefile failed\n");
+    exit();
+  }
+
+  printf(1, "hugefile test ok\n");
+}
+
+// two extent files written a block at a time in turn, so that
+// every block starts a new run and the runs spill into a second
+// extent block; then read back in large pieces.
+void
+extenttest(void)
+{
+  int fd[2], i, j, k, n, nio, *p;
+  struct stat st;
+  char name[] = "extent0";
+
+  printf(1, "extent test\n");
+
+  for(j = 0; j < 2; j++){
+    name[6] = '0' + j;
+    fd[j] = open(name, O_CREATE | O_EXTENT | O_RDWR);
+    if(fd[j] < 0){
+      printf(1, "cannot create %s\n", name);
+      exit();
+    }
+  }
+  if(fstat(fd[0], &st) < 0 || st.type != T_EXTENT){
+    printf(1, "extent file has type %d\n", st.type);
+    exit();
+  }
+  nio = sizeof(buf) / BSIZE;
+  n = NEXTENT + XPB + nio;
+  n -= n % nio;
+  for(i = 0; i < n; i++){
+    for(j = 0; j < 2; j++){
+      memset(buf, 0, BSIZE);
+      ((int*)buf)[0] = i;
+      ((int*)buf)[1] = j;
+      if(write(fd[j], buf, BSIZE) != BSIZE){
+        printf(1, "write extent file failed at block %d\n", i);
+        exit();
+      }
+    }
+  }
+  for(j = 0; j < 2; j++)
+    close(fd[j]);
+
+  for(j = 0; j < 2; j++){
+    name[6] = '0' + j;
+    fd[j] = open(name, 0);
+    for(i = 0; i < n; i += nio){
+      if(read(fd[j], buf, nio*BSIZE) != nio*BSIZE){
+        printf(1, "read %s failed at block %d\n", name, i);
+        exit();
+      }
+      for(k = 0; k < nio; k++){
+        p = (int*)(buf + k*BSIZE);
+        if(p[0] != i + k || p[1] != j){
+          printf(1, "%s block %d has wrong data\n", name, i + k);
+          exit();
+        }
+      }
+    }
+    close(fd[j]);
+    if(unlink(name) < 0){
+      printf(1, "unlink %s failed\n", name);
+      exit();
+    }
+  }
+
+  printf(1, "extent test ok\n");
+}
+
 void
 bigfile(void)
 {
@@ -1373,6 +2412,70 @@ iref(void)
   printf(1, "empty file name OK\n");
 }
 
+// hold more inodes open at once than NINODE;
+// the inode cache must grow rather than panic.
+void
+manyinodes(void)
+{
+  int i, j, fd, pid, n, ready[2], done[2];
+  char name[4], c;
+
+  printf(1, "many inodes test\n");
+  n = 6;
+  if(pipe(ready) < 0 || pipe(done) < 0){
+    printf(1, "manyinodes pipe failed\n");
+    exit();
+  }
+  name[0] = 'm';
+  name[3] = '\0';
+  for(i = 0; i < n; i++){
+    pid = fork();
+    if(pid < 0){
+      printf(1, "manyinodes fork failed\n");
+      exit();
+    }
+    if(pid == 0){
+      close(ready[0]);
+      close(done[1]);
+      for(j = 0; j < 10; j++){
+        name[1] = '0' + i;
+        name[2] = '0' + j;
+        if(open(name, O_CREATE|O_RDWR) < 0){
+          printf(1, "manyinodes open %s failed\n", name);
+          exit();
+        }
+      }
+      write(ready[1], "x", 1);
+      read(done[0], &c, 1);
+      exit();
+    }
+  }
+  close(done[0]);
+  for(i = 0; i < n; i++){
+    if(read(ready[0], &c, 1) != 1){
+      printf(1, "manyinodes child failed\n");
+      exit();
+    }
+  }
+  close(done[1]);
+  for(i = 0; i < n; i++)
+    wait();
+  close(ready[0]);
+  close(ready[1]);
+  for(i = 0; i < n; i++){
+    for(j = 0; j < 10; j++){
+      name[1] = '0' + i;
+      name[2] = '0' + j;
+      unlink(name);
+    }
+  }
+  if((fd = open("m00", 0)) >= 0){
+    printf(1, "manyinodes unlink failed\n");
+    exit();
+  }
+  printf(1, "many inodes ok\n");
+}
+
 // test that fork fails gracefully
 // the forktest binary also does this, but it runs out of proc entries first.
 // inside the bigger usertests binary, we run out of memory first.
@@ -1383,7 +2486,7 @@ forktest(void)
 
   printf(1, "fork test\n");
 
-  for(n=0; n<1000; n++){
+  for(n=0; n<5000; n++){
     pid = fork();
     if(pid < 0)
       break;
@@ -1391,8 +2494,8 @@ forktest(void)
       exit();
   }
 
-  if(n == 1000){
-    printf(1, "fork claimed to work 1000 times!\n");
+  if(n == 5000){
+    printf(1, "fork claimed to work 5000 times!\n");
     exit();
   }
 
@@ -1559,6 +2662,59 @@ validateint(int *p)
       "ebx");
 }
 
+// getpid through sysenter with the trap flag set, which
+// sysenter leaves on for the kernel's first instruction.
+int
+tfgetpid(void)
+{
+  int res;
+  asm volatile("pushfl\n\t"
+               "orl $0x100, (%%esp)\n\t"
+               "leal 4(%%esp), %%ecx\n\t"
+               "movl $1f, %%edx\n\t"
+               "popfl\n\t"
+               "sysenter\n"
+               "1:" :
+               "=a" (res) :
+               "a" (SYS_getpid) :
+               "ecx", "edx", "memory", "cc");
+  return res;
+}
+
+void
+sysentertftest(void)
+{
+  int fds[2], pid;
+  char c;
+
+  printf(stdout, "sysenter tf test\n");
+  if(pipe(fds) != 0){
+    printf(stdout, "pipe failed\n");
+    exit();
+  }
+  pid = fork();
+  if(pid < 0){
+    printf(stdout, "fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    close(fds[0]);
+    // The kernel must neither panic nor hand the flag back,
+    // which would kill us at the next instruction.
+    if(tfgetpid() == getpid())
+      write(fds[1], "x", 1);
+    exit();
+  }
+  close(fds[1]);
+  if(read(fds[0], &c, 1) != 1){
+    printf(stdout, "sysenter with TF failed\n");
+    exit();
+  }
+  close(fds[0]);
+  wait();
+  printf(stdout, "sysenter tf test ok\n");
+}
+
 void
 validatetest(void)
 {
@@ -1769,10 +2925,23 @@ main(int argc, char *argv[])
   bsstest();
   sbrktest();
   validatetest();
+  sysentertftest();
 
   opentest();
   writetest();
   writetest1();
+  fsynctest();
+  fallocatetest();
+  piotest();
+  bigreadtest();
+  sendfiletest();
+  dcachetest();
+  getdentstest();
+  fdtabletest();
+  vdsotest();
+  ringtest();
+  lookuptest();
+  lookupunlinktest();
   createtest();
 
   openiputtest();
@@ -1781,19 +2950,25 @@ main(int argc, char *argv[])
 
   mem();
   pipe1();
+  pipesizetest();
   preempt();
   exitwait();
 
   rmdot();
   fourteen();
   bigfile();
+  hugefile();
+  extenttest();
   subdir();
   linktest();
   unlinkread();
   dirfile();
   iref();
+  manyinodes();
   forktest();
   bigdir(); // slow
+  hashdir(); // slow
+  hashcollide();
 
   uio();
 
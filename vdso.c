@@ -0,0 +1,51 @@
+// The shared vDSO page, which vdsomap in vm.c maps read-only
+// into every process at VDSO along with its own page at VPROC.
+//
+// CPU 0 publishes each timer tick here with the TSC value it
+// saw, and keeps a running measure of TSC cycles per tick, so
+// that user programs can interpolate between ticks. This
+// assumes that the CPUs' TSCs run together.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "proc.h"
+#include "x86.h"
+#include "vdso.h"
+
+struct vdso *vdso;
+
+void
+vdsoinit(void)
+{
+  if((vdso = (struct vdso*)kalloc()) == 0)
+    panic("vdsoinit");
+  memset(vdso, 0, PGSIZE);
+  vdso->ncpu = ncpu;
+}
+
+// Publish timer tick ticks. Called on CPU 0 only.
+void
+vdsotick(uint ticks)
+{
+  static uint64 last;
+  static uint pertick;
+  uint64 now;
+  uint d;
+
+  now = rdtsc();
+  if(last){
+    d = now - last;
+    pertick = pertick ? pertick - pertick/8 + d/8 : d;
+  }
+  last = now;
+
+  vdso->seq++;
+  __sync_synchronize();
+  vdso->ticks = ticks;
+  vdso->tsc = now;
+  vdso->tscperus = pertick / TICKUS;
+  __sync_synchronize();
+  vdso->seq++;
+}
@@ -0,0 +1,21 @@
+// Pages the kernel maps read-only at the top of every user
+// address space, just below KERNBASE, so that programs can read
+// the time and a few facts about themselves without a system
+// call. See vdso.c, and the v* functions in ulib.c.
+
+#define VDSO   0x7FFFE000  // struct vdso, shared by all processes
+#define VPROC  0x7FFFF000  // struct vproc, the process's own
+#define TICKUS 10000       // nominal microseconds per timer tick
+
+struct vdso {
+  volatile uint seq;       // odd while the kernel updates the clock
+  volatile uint ticks;     // what uptime() returns
+  volatile uint64 tsc;     // TSC at the last tick
+  volatile uint tscperus;  // TSC cycles per microsecond, if a tick is TICKUS
+  int ncpu;
+};
+
+struct vproc {
+  int pid;
+  volatile int cpu;        // CPU the process last ran on
+};
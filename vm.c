@@ -6,8 +6,12 @@
 #include "mmu.h"
 #include "proc.h"
 #include "elf.h"
+#include "vdso.h"
+#include "ring.h"
 
 extern char data[];  // defined by kernel.ld
+extern void sysenter(void);  // in trapasm.S
+static void sysenterinit(struct cpu*);
 pde_t *kpgdir;  // for use in scheduler()
 
 // Set up CPU's kernel segment descriptors.
@@ -27,6 +31,29 @@ seginit(void)
   c->gdt[SEG_UCODE] = SEG(STA_X|STA_R, 0, 0xffffffff, DPL_USER);
   c->gdt[SEG_UDATA] = SEG(STA_W, 0, 0xffffffff, DPL_USER);
   lgdt(c->gdt, sizeof(c->gdt));
+  sysenterinit(c);
+}
+
+// Set up this CPU for the sysenter system calls in usys.S.
+// sysenter takes the kernel stack segment and sysexit the user
+// ones from the selectors after SEG_KCODE, in the order the GDT
+// has them. The stack it loads is c->sysstack, whose top word
+// points at ts.esp0, which switchuvm keeps up to date; see
+// trapasm.S.
+// A CPU without sysenter faults on it instead, and trap()
+// does the system call the slow way.
+static void
+sysenterinit(struct cpu *c)
+{
+  uint a, b, cx, d;
+
+  cpuinfo(1, &a, &b, &cx, &d);
+  if((d & CPUID_SEP) == 0)
+    return;
+  wrmsr(MSR_SYSENTER_CS, SEG_KCODE<<3);
+  c->sysstack[NELEM(c->sysstack)-1] = (uint)&c->ts.esp0;
+  wrmsr(MSR_SYSENTER_ESP, (uint)&c->sysstack[NELEM(c->sysstack)-1]);
+  wrmsr(MSR_SYSENTER_EIP, (uint)sysenter);
 }
 
 // Return the address of the PTE in page table pgdir
@@ -87,8 +114,10 @@ mappages(pde_t *pgdir, void *va, uint size, uint pa, int perm)
 //
 // setupkvm() and exec() set up every page table like this:
 //
-//   0..KERNBASE: user memory (text+data+stack+heap), mapped to
+//   0..RING: user memory (text+data+stack+heap), mapped to
 //                phys memory allocated by the kernel
+//   RING..VDSO: the process's I/O ring, if any (see ring.h)
+//   VDSO..KERNBASE: vDSO pages, read-only (see vdso.h)
 //   KERNBASE..KERNBASE+EXTMEM: mapped to 0..EXTMEM (for I/O space)
 //   KERNBASE+EXTMEM..data: mapped to EXTMEM..V2P(data)
 //                for the kernel's instructions and r/o data
@@ -169,6 +198,7 @@ switchuvm(struct proc *p)
   mycpu()->gdt[SEG_TSS].s = 0;
   mycpu()->ts.ss0 = SEG_KDATA << 3;
   mycpu()->ts.esp0 = (uint)p->kstack + KSTACKSIZE;
+  p->vproc->cpu = mycpu() - cpus;
   // setting IOPL=0 in eflags *and* iomb beyond the tss segment limit
   // forbids I/O instructions (e.g., inb and outb) from user space
   mycpu()->ts.iomb = (ushort) 0xFFFF;
@@ -224,7 +254,7 @@ allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
   char *mem;
   uint a;
 
-  if(newsz >= KERNBASE)
+  if(newsz > RING)
     return 0;
   if(newsz < oldsz)
     return oldsz;
@@ -287,7 +317,7 @@ freevm(pde_t *pgdir)
 
   if(pgdir == 0)
     panic("freevm: no pgdir");
-  deallocuvm(pgdir, KERNBASE, 0);
+  deallocuvm(pgdir, RING, 0);  // the ring and vDSO pages are not ours
   for(i = 0; i < NPDENTRIES; i++){
     if(pgdir[i] & PTE_P){
       char * v = P2V(PTE_ADDR(pgdir[i]));
@@ -297,6 +327,26 @@ freevm(pde_t *pgdir)
   kfree((char*)pgdir);
 }
 
+// Map the shared vDSO page and p's own page read-only
+// at VDSO and VPROC in pgdir.
+int
+vdsomap(pde_t *pgdir, struct proc *p)
+{
+  extern struct vdso *vdso;
+
+  if(mappages(pgdir, (char*)VDSO, PGSIZE, V2P(vdso), PTE_U) < 0 ||
+     mappages(pgdir, (char*)VPROC, PGSIZE, V2P(p->vproc), PTE_U) < 0)
+    return -1;
+  return 0;
+}
+
+// Map the ring page mem at RING in pgdir, writable by the user.
+int
+ringmap(pde_t *pgdir, char *mem)
+{
+  return mappages(pgdir, (char*)RING, PGSIZE, V2P(mem), PTE_W|PTE_U);
+}
+
 // Clear PTE_U on a page. Used to create an inaccessible
 // page beneath the user stack.
 void